@@ -1,171 +1,257 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
 #include <assert.h>
 
 #include <aoc/mapcache.h>
 
 #define trailhead	'0'
+#define summit		'9'
+#define SUMMIT_HEIGHT	9
 
-struct trail {
-	unsigned long trail_id; /* unique_id9 is used as our key */
-	unsigned long trail_start;
-	struct trail *link;
+/* the topographic map copied out of the mapcache into a flat row-major
+ * array, with the tiles of every height listed layer by layer. tiles that
+ * are not a digit belong to no layer and are never walked on. */
+struct topo_map {
+#define NO_HEIGHT	0xFF
+	uint8_t *heights;
+	int width;
+	int height;
+	size_t tile_count;
+	size_t *layer_tiles; /* tiles sorted by height */
+	size_t layer_start[SUMMIT_HEIGHT + 2];
 };
 
-#define HASH_TABLE_SHIFT	7
-#define HASH_TABLE_SIZE		(1 << HASH_TABLE_SHIFT)
-static struct trail *trail_hash_table[HASH_TABLE_SIZE] = {0};
-
-static unsigned long fnv1a_hash(char *data, size_t size)
+static struct topo_map *new_topo_map(struct aoc_mapcache *mapcache)
 {
-	size_t i;
-	unsigned char *pdata = (unsigned char *)data;
-	static const unsigned long fnv1a_offset = 0xcbf29ce484222325;
-	static const unsigned long fnv1a_prime = 0x100000001b3;
-	unsigned long h;
-	h = fnv1a_offset;
-	for (i = 0; i < size; i++) {
-		h = h ^ pdata[i];
-		h = h * fnv1a_prime;
+	struct topo_map *map;
+	size_t layer_fill[SUMMIT_HEIGHT + 1];
+	size_t tile;
+	int h;
+
+	map = malloc(sizeof * map);
+	assert(map != NULL);
+	map->width = aoc_mapcache_width(mapcache);
+	map->height = aoc_mapcache_height(mapcache);
+	map->tile_count = (size_t)map->width * map->height;
+	map->heights = malloc(map->tile_count * sizeof * map->heights);
+	assert(map->heights != NULL);
+	map->layer_tiles = malloc(map->tile_count * sizeof * map->layer_tiles);
+	assert(map->layer_tiles != NULL);
+
+	for (h = 0; h < SUMMIT_HEIGHT + 2; h++) {
+		map->layer_start[h] = 0;
 	}
-	return h;
+
+	aoc_mapcache_reset(mapcache);
+	for (;;) {
+		int ch;
+		int row;
+		int col;
+		ch = aoc_mapcache_tile(mapcache, NULL);
+		aoc_mapcache_coord(mapcache, &row, &col);
+		tile = (size_t)row * map->width + col;
+		if (ch >= trailhead && ch <= summit) {
+			map->heights[tile] = ch - trailhead;
+			map->layer_start[ch - trailhead + 1] += 1;
+		} else {
+			map->heights[tile] = NO_HEIGHT;
+		}
+		if (aoc_mapcache_walk_forward(mapcache) == -1)
+			break;
+	}
+
+	/* counting sort of the tiles by height */
+	for (h = 0; h <= SUMMIT_HEIGHT; h++) {
+		map->layer_start[h + 1] += map->layer_start[h];
+		layer_fill[h] = map->layer_start[h];
+	}
+	for (tile = 0; tile < map->tile_count; tile++) {
+		h = map->heights[tile];
+		if (h == NO_HEIGHT)
+			continue;
+		map->layer_tiles[layer_fill[h]] = tile;
+		layer_fill[h] += 1;
+	}
+	return map;
 }
 
-static struct trail *new_trail(unsigned long unique_id9, 
-	unsigned long unique_id0)
+static void free_topo_map(struct topo_map *map)
 {
-	struct trail *trail;
-	trail = malloc(sizeof * trail);
-	assert(trail != NULL);
-	trail->trail_id = unique_id9;
-	trail->trail_start = unique_id0;
-	trail->link = NULL;
-	return trail;
+	free(map->layer_tiles);
+	free(map->heights);
+	free(map);
+	return;
 }
 
-static int process_this_trail(unsigned long unique_id9,
-	unsigned long unique_id0)
-{
-	int i;
-	struct trail **trailpp;
-	i = fnv1a_hash((char *)&unique_id9, sizeof unique_id9);
-	i &= (HASH_TABLE_SIZE-1);
-	trailpp = &trail_hash_table[i];
-	for(;;) {
-		struct trail *trailp = *trailpp;
-		if (trailp == NULL)
-			break;
-		if (trailp->trail_id == unique_id9 && 
-			trailp->trail_start == unique_id0) {
-			return 0;
-		}
+/* the summits reachable from every tile of one layer, as sorted lists of
+ * summit numbers: the list of the k-th tile of the layer is
+ * ids[start[k]] up to ids[start[k + 1]]. a trail is only 9 steps long, so
+ * a tile can reach no more summits than there are tiles within 9 steps of
+ * it, and the lists stay short however large the map is. */
+struct summit_lists {
+#define SUMMIT_LISTS_SIZE	1024
+	uint32_t *ids;
+	size_t id_count;
+	size_t id_size;
+	size_t *start;
+};
 
-		trailpp = &(trailp->link);
-	}
-	*trailpp = new_trail(unique_id9, unique_id0);
-	return 1;
+static void init_summit_lists(struct summit_lists *lists, size_t tile_count)
+{
+	lists->ids = NULL;
+	lists->id_count = 0;
+	lists->id_size = 0;
+	lists->start = malloc((tile_count + 1) * sizeof * lists->start);
+	assert(lists->start != NULL);
+	lists->start[0] = 0;
+	return;
 }
 
-static int process_trailhead(struct aoc_mapcache *mapcache, int height,
-	unsigned long unique_id0)
+static void release_summit_lists(struct summit_lists *lists)
 {
-	int chnum;
-	int score = 0;
-	unsigned long unique_id9;
-	chnum = aoc_mapcache_tile(mapcache, &unique_id9) - '0';
-	if (chnum != height) {
-		return 0;
-	}
+	free(lists->ids);
+	free(lists->start);
+	return;
+}
 
-	if (height == 9) {
-		assert(chnum == height);
-		return process_this_trail(unique_id9, unique_id0);
+static void summit_lists_append(struct summit_lists *lists, uint32_t id)
+{
+	if (lists->id_count == lists->id_size) {
+		lists->id_size = lists->id_size ? lists->id_size * 2 :
+			SUMMIT_LISTS_SIZE;
+		lists->ids = realloc(lists->ids,
+			lists->id_size * sizeof * lists->ids);
+		assert(lists->ids != NULL);
 	}
+	lists->ids[lists->id_count] = id;
+	lists->id_count += 1;
+	return;
+}
 
-	height += 1;
+/* the tiles next to a tile that are one step higher. returns how many */
+static int upper_neighbours(struct topo_map *map, size_t tile,
+		size_t *neighbours)
+{
+	int row = tile / map->width;
+	int col = tile % map->width;
+	int up_height = map->heights[tile] + 1;
+	int count = 0;
 
-	/* if we can go up from here, do so. */
-	if (aoc_mapcache_step_up(mapcache) != -1) {
-		score += process_trailhead(mapcache, height, unique_id0);
-		aoc_mapcache_step_down(mapcache);
-	}
+	if (row > 0 && map->heights[tile - map->width] == up_height)
+		neighbours[count++] = tile - map->width;
+	if (row < map->height - 1 && map->heights[tile + map->width] == up_height)
+		neighbours[count++] = tile + map->width;
+	if (col > 0 && map->heights[tile - 1] == up_height)
+		neighbours[count++] = tile - 1;
+	if (col < map->width - 1 && map->heights[tile + 1] == up_height)
+		neighbours[count++] = tile + 1;
+	return count;
+}
 
-	assert(aoc_mapcache_tile(mapcache, NULL)-'0' == chnum);
+/* merge the summit lists of the higher neighbours of a tile into the
+ * next list of lower, dropping summits reached along several of them */
+static void merge_from_neighbours(struct topo_map *map,
+		struct summit_lists *upper, struct summit_lists *lower,
+		size_t upper_first, const size_t *rank, size_t tile)
+{
+	size_t neighbours[4];
+	size_t next[4];
+	size_t end[4];
+	int count;
+	int n;
 
-	/* if we can go right from here, do so. */
-	if (aoc_mapcache_step_right(mapcache) != -1) {
-		score += process_trailhead(mapcache, height, unique_id0);
-		aoc_mapcache_step_left(mapcache);
+	count = upper_neighbours(map, tile, neighbours);
+	for (n = 0; n < count; n++) {
+		size_t k = rank[neighbours[n]] - upper_first;
+		next[n] = upper->start[k];
+		end[n] = upper->start[k + 1];
 	}
-	
-	assert(aoc_mapcache_tile(mapcache, NULL)-'0' == chnum);
 
-	/* if we can go down from here, do so. */
-	if (aoc_mapcache_step_down(mapcache) != -1) {
-		score += process_trailhead(mapcache, height, unique_id0);
-		aoc_mapcache_step_up(mapcache);
+	for (;;) {
+		uint32_t id = UINT32_MAX;
+		bool found = false;
+		for (n = 0; n < count; n++) {
+			if (next[n] < end[n] && upper->ids[next[n]] <= id) {
+				id = upper->ids[next[n]];
+				found = true;
+			}
+		}
+		if (found == false)
+			break;
+		for (n = 0; n < count; n++) {
+			if (next[n] < end[n] && upper->ids[next[n]] == id)
+				next[n] += 1;
+		}
+		summit_lists_append(lower, id);
 	}
+	return;
+}
 
-	assert(aoc_mapcache_tile(mapcache, NULL)-'0' == chnum);
+/* the score of a trailhead is the number of summits it can reach. the
+ * summit lists are built layer by layer from height 9 down to 0, each
+ * layer from the lists of the one above, so only two layers are kept. */
+static unsigned long trail_score(struct topo_map *map)
+{
+	size_t summit_first = map->layer_start[SUMMIT_HEIGHT];
+	size_t summit_last = map->layer_start[SUMMIT_HEIGHT + 1];
+	struct summit_lists upper;
+	struct summit_lists lower;
+	size_t *rank; /* position of a tile in layer_tiles */
+	unsigned long score;
+	size_t i;
+	int h;
 
-	/* if we can go left from here, do so. */
-	if (aoc_mapcache_step_left(mapcache) != -1) {
-		score += process_trailhead(mapcache, height, unique_id0);
-		aoc_mapcache_step_right(mapcache);
+	rank = malloc(map->tile_count * sizeof * rank);
+	assert(rank != NULL);
+	for (i = 0; i < map->layer_start[SUMMIT_HEIGHT + 1]; i++) {
+		rank[map->layer_tiles[i]] = i;
 	}
-	
-	assert(aoc_mapcache_tile(mapcache, NULL)-'0' == chnum);
-	
-	return score;
-}
 
-static void free_hash_chain(struct trail *trail)
-{
-	struct trail *ptr = trail;
-	while(ptr != NULL) {
-		struct trail *tmp = ptr->link;
-		free(ptr);
-		ptr = tmp;
+	init_summit_lists(&upper, map->tile_count);
+	init_summit_lists(&lower, map->tile_count);
+	for (i = summit_first; i < summit_last; i++) {
+		assert(i - summit_first < UINT32_MAX);
+		summit_lists_append(&upper, i - summit_first);
+		upper.start[i - summit_first + 1] = upper.id_count;
 	}
-	return;
-}
 
-static void free_hash_table(struct trail **hash_tab,
-		size_t size)
-{
-	size_t i;
-	for(i = 0; i < size; i += 1) {
-		struct trail *trail = hash_tab[i];
-		if (trail == NULL)
-			continue;
-		free_hash_chain(trail);
-		hash_tab[i] = NULL;
+	for (h = SUMMIT_HEIGHT - 1; h >= 0; h--) {
+		struct summit_lists tmp;
+		size_t first = map->layer_start[h];
+		lower.id_count = 0;
+		for (i = first; i < map->layer_start[h + 1]; i++) {
+			merge_from_neighbours(map, &upper, &lower,
+				map->layer_start[h + 1], rank,
+				map->layer_tiles[i]);
+			lower.start[i - first + 1] = lower.id_count;
+		}
+		tmp = upper;
+		upper = lower;
+		lower = tmp;
 	}
-	return;
+	score = upper.id_count;
+
+	release_summit_lists(&lower);
+	release_summit_lists(&upper);
+	free(rank);
+	return score;
 }
 
 int main(void)
 {
 	struct aoc_mapcache *mapcache;
-	int ch;
-	int score = 0;
+	struct topo_map *map;
 
 	mapcache = aoc_new_mapcache("input");
 	if (mapcache == NULL) {
 		return -1;
 	}
-	for (;;) {
-		unsigned long unique_id;
-		ch = aoc_mapcache_tile(mapcache, &unique_id);
-		if (ch == trailhead) {
-			score += process_trailhead(mapcache, 0, unique_id);	
-		}
-		if (aoc_mapcache_walk_forward(mapcache) == -1)
-			break;
-	}
-	printf("score is %d\n", score);
+	map = new_topo_map(mapcache);
 	aoc_free_mapcache(mapcache);
-	free_hash_table(trail_hash_table, HASH_TABLE_SIZE);
+
+	printf("score is %lu\n", trail_score(map));
+	free_topo_map(map);
 	return 0;
 }
-
@@ -1,91 +1,158 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
 #include <assert.h>
 
 #include <aoc/mapcache.h>
 
 #define trailhead	'0'
+#define summit		'9'
+#define SUMMIT_HEIGHT	9
 
-struct trail {
-	unsigned long trail_id; /* unique_id9 is used as our key */
-	unsigned long trail_start;
-	struct trail *link;
+/* the topographic map copied out of the mapcache into a flat row-major
+ * array, with the tiles of every height listed layer by layer. tiles that
+ * are not a digit belong to no layer and are never walked on. */
+struct topo_map {
+#define NO_HEIGHT	0xFF
+	uint8_t *heights;
+	int width;
+	int height;
+	size_t tile_count;
+	size_t *layer_tiles; /* tiles sorted by height */
+	size_t layer_start[SUMMIT_HEIGHT + 2];
 };
 
-static int process_trailhead(struct aoc_mapcache *mapcache, int height,
-	unsigned long unique_id0)
+static struct topo_map *new_topo_map(struct aoc_mapcache *mapcache)
 {
-	int chnum;
-	int score = 0;
-	unsigned long unique_id9;
-	chnum = aoc_mapcache_tile(mapcache, &unique_id9) - '0';
-	if (chnum != height) {
-		return 0;
-	}
+	struct topo_map *map;
+	size_t layer_fill[SUMMIT_HEIGHT + 1];
+	size_t tile;
+	int h;
+
+	map = malloc(sizeof * map);
+	assert(map != NULL);
+	map->width = aoc_mapcache_width(mapcache);
+	map->height = aoc_mapcache_height(mapcache);
+	map->tile_count = (size_t)map->width * map->height;
+	map->heights = malloc(map->tile_count * sizeof * map->heights);
+	assert(map->heights != NULL);
+	map->layer_tiles = malloc(map->tile_count * sizeof * map->layer_tiles);
+	assert(map->layer_tiles != NULL);
 
-	if (height == 9) {
-		assert(chnum == height);
-		return 1;
+	for (h = 0; h < SUMMIT_HEIGHT + 2; h++) {
+		map->layer_start[h] = 0;
 	}
 
-	height += 1;
+	aoc_mapcache_reset(mapcache);
+	for (;;) {
+		int ch;
+		int row;
+		int col;
+		ch = aoc_mapcache_tile(mapcache, NULL);
+		aoc_mapcache_coord(mapcache, &row, &col);
+		tile = (size_t)row * map->width + col;
+		if (ch >= trailhead && ch <= summit) {
+			map->heights[tile] = ch - trailhead;
+			map->layer_start[ch - trailhead + 1] += 1;
+		} else {
+			map->heights[tile] = NO_HEIGHT;
+		}
+		if (aoc_mapcache_walk_forward(mapcache) == -1)
+			break;
+	}
 
-	/* if we can go up from here, do so. */
-	if (aoc_mapcache_step_up(mapcache) != -1) {
-		score += process_trailhead(mapcache, height, unique_id0);
-		aoc_mapcache_step_down(mapcache);
+	/* counting sort of the tiles by height */
+	for (h = 0; h <= SUMMIT_HEIGHT; h++) {
+		map->layer_start[h + 1] += map->layer_start[h];
+		layer_fill[h] = map->layer_start[h];
 	}
+	for (tile = 0; tile < map->tile_count; tile++) {
+		h = map->heights[tile];
+		if (h == NO_HEIGHT)
+			continue;
+		map->layer_tiles[layer_fill[h]] = tile;
+		layer_fill[h] += 1;
+	}
+	return map;
+}
 
-	assert(aoc_mapcache_tile(mapcache, NULL)-'0' == chnum);
+static void free_topo_map(struct topo_map *map)
+{
+	free(map->layer_tiles);
+	free(map->heights);
+	free(map);
+	return;
+}
 
-	/* if we can go right from here, do so. */
-	if (aoc_mapcache_step_right(mapcache) != -1) {
-		score += process_trailhead(mapcache, height, unique_id0);
-		aoc_mapcache_step_left(mapcache);
-	}
-	
-	assert(aoc_mapcache_tile(mapcache, NULL)-'0' == chnum);
+/* merge the number of trails leading on to a summit from the neighbours
+ * of a tile that are one step higher */
+static uint64_t count_from_neighbours(struct topo_map *map,
+		uint64_t *paths, size_t tile)
+{
+	int row = tile / map->width;
+	int col = tile % map->width;
+	int up_height = map->heights[tile] + 1;
+	uint64_t count = 0;
+
+	if (row > 0 && map->heights[tile - map->width] == up_height)
+		count += paths[tile - map->width];
+	if (row < map->height - 1 && map->heights[tile + map->width] == up_height)
+		count += paths[tile + map->width];
+	if (col > 0 && map->heights[tile - 1] == up_height)
+		count += paths[tile - 1];
+	if (col < map->width - 1 && map->heights[tile + 1] == up_height)
+		count += paths[tile + 1];
+	return count;
+}
+
+/* the rating of a trailhead is the number of distinct trails starting at
+ * it. paths(tile) is the sum of paths over its neighbours one step higher,
+ * with every summit ending one trail, so a single pass over the layers
+ * from height 9 down to 0 counts them all. */
+static uint64_t trail_rating(struct topo_map *map)
+{
+	uint64_t rating = 0;
+	uint64_t *paths;
+	size_t i;
+	int h;
+
+	paths = malloc(map->tile_count * sizeof * paths);
+	assert(paths != NULL);
 
-	/* if we can go down from here, do so. */
-	if (aoc_mapcache_step_down(mapcache) != -1) {
-		score += process_trailhead(mapcache, height, unique_id0);
-		aoc_mapcache_step_up(mapcache);
+	for (i = map->layer_start[SUMMIT_HEIGHT];
+		i < map->layer_start[SUMMIT_HEIGHT + 1]; i++) {
+		paths[map->layer_tiles[i]] = 1;
 	}
 
-	assert(aoc_mapcache_tile(mapcache, NULL)-'0' == chnum);
+	for (h = SUMMIT_HEIGHT - 1; h >= 0; h--) {
+		for (i = map->layer_start[h]; i < map->layer_start[h + 1]; i++) {
+			size_t tile = map->layer_tiles[i];
+			paths[tile] = count_from_neighbours(map, paths, tile);
+		}
+	}
 
-	/* if we can go left from here, do so. */
-	if (aoc_mapcache_step_left(mapcache) != -1) {
-		score += process_trailhead(mapcache, height, unique_id0);
-		aoc_mapcache_step_right(mapcache);
+	for (i = map->layer_start[0]; i < map->layer_start[1]; i++) {
+		rating += paths[map->layer_tiles[i]];
 	}
-	
-	assert(aoc_mapcache_tile(mapcache, NULL)-'0' == chnum);
-	
-	return score;
+
+	free(paths);
+	return rating;
 }
 
 int main(void)
 {
 	struct aoc_mapcache *mapcache;
-	int ch;
-	int score = 0;
+	struct topo_map *map;
 
 	mapcache = aoc_new_mapcache("input");
 	if (mapcache == NULL) {
 		return -1;
 	}
-	for (;;) {
-		unsigned long unique_id;
-		ch = aoc_mapcache_tile(mapcache, &unique_id);
-		if (ch == trailhead) {
-			score += process_trailhead(mapcache, 0, unique_id);	
-		}
-		if (aoc_mapcache_walk_forward(mapcache) == -1)
-			break;
-	}
-	printf("score is %d\n", score);
+	map = new_topo_map(mapcache);
 	aoc_free_mapcache(mapcache);
+
+	printf("score is %lu\n", (unsigned long)trail_rating(map));
+	free_topo_map(map);
 	return 0;
 }
-
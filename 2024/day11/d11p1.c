@@ -2,35 +2,28 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <stdbool.h>
+#include <limits.h>
+#include <stdint.h>
 
-#include <aoc/lncache.h>
-#include <aoc/dlist.h>
+#include <aoc/lut.h>
+#include <aoc/die.h>
 
-struct stone {
-	unsigned long value;
-	struct aoc_dlist_node link;
-};
+#ifndef BLINK_COUNT
+#define BLINK_COUNT	25ULL
+#endif
 
-static void init_stone_list(struct aoc_dlist_node *stone_list, 
-	struct aoc_line *line)
-{
-	char buffer[1024];
-	char *endptr = buffer;
-	unsigned long value;
-	assert(aoc_line_strlen(line) <= sizeof buffer);
-	aoc_line_get(line, buffer, sizeof buffer);
-	while(*endptr != '\0') {
-		struct stone *stone;
-		value = strtoul(endptr, &endptr, 10);
-		stone = malloc(sizeof * stone);
-		assert(stone != NULL);
-		stone->value = value;
-		aoc_dlist_prepend(stone_list, &stone->link);
-		if (*endptr == ' ')
-			endptr += 1;
-	}
-	return;
-}
+/* when non-zero, stones are counted modulo STONE_MODULUS */
+#ifndef STONE_MODULUS
+#define STONE_MODULUS	0ULL
+#endif
+#if STONE_MODULUS > 0xFFFFFFFF
+#error "STONE_MODULUS must fit 32 bits"
+#endif
+
+/* more blinks than this are only counted by fast-forwarding */
+#define STONE_BLINK_MAX	(1ULL << 20)
+
+typedef unsigned __int128 stone_count_t;
 
 static int value_digit_n(unsigned long value)
 {
@@ -42,12 +35,10 @@ static int value_digit_n(unsigned long value)
 	return count;
 }
 
-static bool stone_has_even_digits(struct stone *stone)
+static bool stone_has_even_digits(unsigned long value)
 {
 	int count;
-	assert(stone != NULL);
-	assert(stone->value != 0);
-	count = value_digit_n(stone->value);
+	count = value_digit_n(value);
 	return count & 1 ? false : true;
 }
 
@@ -61,124 +52,557 @@ static unsigned long unsigned_pow(unsigned long base, unsigned long exponent)
 	return result;
 }
 
-static void split_stone(struct stone *stone1, struct stone **stone2pp)
+static void split_stone(unsigned long value, unsigned long *value1,
+	unsigned long *value2)
 {
 	int count;
-	assert(stone1 != NULL);
-	assert(stone2pp != NULL);
-	assert(stone_has_even_digits(stone1) == true);
-	count = value_digit_n(stone1->value) >> 1;
+	assert(value1 != NULL);
+	assert(value2 != NULL);
+	assert(stone_has_even_digits(value) == true);
+	count = value_digit_n(value) >> 1;
 	assert(count > 0);
 
 	unsigned long divisor = unsigned_pow(10, count);
-	unsigned long value = stone1->value;
-	stone1->value = value / divisor;
+	*value1 = value / divisor;
+	*value2 = value % divisor;
+	return;
+}
 
-	struct stone *stone2;
-	stone2 = malloc(sizeof *stone2);
-	assert(stone2 != NULL);
-	stone2->value = value % divisor;
+/* every stone value met so far gets a dense id. the values a stone turns
+ * into on a blink are kept in compressed sparse row form: the children of
+ * stone id are children[child_start[id]] up to children[child_start[id + 1]].
+ * the lut from value to id is only needed while the graph is compiled. */
+struct stone_graph {
+#define STONE_GRAPH_SIZE	1024
+#define STONE_IDS_SIZE		1024
+	unsigned long *values;
+	size_t *child_start;
+	size_t node_count;
+	size_t node_size;
+	size_t *children;
+	size_t child_count;
+	size_t child_size;
+	struct aoc_lut *ids;
+};
 
-	*stone2pp = stone2;
+static void init_stone_graph(struct stone_graph *graph)
+{
+	graph->values = NULL;
+	graph->child_start = NULL;
+	graph->node_count = 0;
+	graph->node_size = 0;
+	graph->children = NULL;
+	graph->child_count = 0;
+	graph->child_size = 0;
+	graph->ids = aoc_new_lut(12, sizeof(unsigned long), sizeof(size_t));
+	assert(graph->ids != NULL);
+	return;
+}
 
+static void release_stone_graph(struct stone_graph *graph)
+{
+	free(graph->values);
+	free(graph->child_start);
+	free(graph->children);
+	if (graph->ids != NULL)
+		aoc_free_lut(graph->ids);
 	return;
 }
 
-static void blink(struct aoc_dlist_node *stone_list)
+/* id of a stone value, handing out the next id to values not seen yet */
+static size_t stone_graph_id(struct stone_graph *graph, unsigned long value)
 {
-	struct aoc_dlist_node *ptr;
-	for (ptr = stone_list->next; ptr != stone_list; ptr = ptr->next) {
-		struct stone *stone;
-		stone = aoc_dlist_container(ptr, offsetof(struct stone, link));
-		
-		/* rule 1: if a stone is 0, then replace it with 1 */
-		if (stone->value == 0) {
-			stone->value = 1;
-			continue;
-		}
+	size_t id;
+	if (aoc_lut_lookup(graph->ids, &value, sizeof value, &id, sizeof id) == 0)
+		return id;
 
-		/* rule 2: if a stone has even numbered digits, split it */
-		
-		if (stone_has_even_digits(stone)) {
-			struct stone *stone2 = NULL;
-			split_stone(stone, &stone2);
+	if (graph->node_count == graph->node_size) {
+		graph->node_size = graph->node_size ? graph->node_size * 2 :
+			STONE_GRAPH_SIZE;
+		graph->values = realloc(graph->values,
+			graph->node_size * sizeof * graph->values);
+		assert(graph->values != NULL);
+		graph->child_start = realloc(graph->child_start,
+			(graph->node_size + 1) * sizeof * graph->child_start);
+		assert(graph->child_start != NULL);
+	}
+	id = graph->node_count;
+	graph->values[id] = value;
+	graph->node_count += 1;
+	assert(aoc_lut_add(graph->ids, &value, sizeof value, &id, sizeof id) == 0);
+	return id;
+}
 
-			/* add new stone2 now to list */
-			assert(stone2 != NULL);
-			aoc_dlist_append(&stone->link, &stone2->link);
+static void stone_graph_add_child(struct stone_graph *graph,
+	unsigned long value)
+{
+	size_t id = stone_graph_id(graph, value);
+	if (graph->child_count == graph->child_size) {
+		graph->child_size = graph->child_size ? graph->child_size * 2 :
+			STONE_GRAPH_SIZE;
+		graph->children = realloc(graph->children,
+			graph->child_size * sizeof * graph->children);
+		assert(graph->children != NULL);
+	}
+	graph->children[graph->child_count] = id;
+	graph->child_count += 1;
+	return;
+}
 
-			/* and also skip it from the traversal */
-			ptr = ptr->next;
+/* apply the rules to a stone, recording the stones it turns into */
+static void stone_graph_expand(struct stone_graph *graph, size_t id)
+{
+	unsigned long value = graph->values[id];
+	graph->child_start[id] = graph->child_count;
+	if (value == 0) {
+		stone_graph_add_child(graph, 1);
+	} else if (stone_has_even_digits(value) == true) {
+		unsigned long value1;
+		unsigned long value2;
+		split_stone(value, &value1, &value2);
+		stone_graph_add_child(graph, value1);
+		stone_graph_add_child(graph, value2);
+	} else {
+		assert(value <= ULONG_MAX / 2024);
+		stone_graph_add_child(graph, value * 2024);
+	}
+	return;
+}
 
+/* expand the stones reachable within depth blinks from the stones that
+ * are in the graph already, level by level. the set of values reached
+ * closes after a few thousand stones, which usually ends the walk long
+ * before depth does. stones on the last level keep no children.
+ * returns true if the graph is closed, every stone being expanded. */
+static bool compile_stone_graph(struct stone_graph *graph,
+	unsigned long long depth)
+{
+	size_t level_end = graph->node_count;
+	size_t id;
+	bool closed;
+	for (id = 0; id < graph->node_count; id++) {
+		if (id == level_end) {
+			depth -= 1;
+			level_end = graph->node_count;
+		}
+		if (depth == 0)
+			break;
+		stone_graph_expand(graph, id);
+	}
+	closed = (id == graph->node_count);
+	for (; id <= graph->node_count; id++) {
+		graph->child_start[id] = graph->child_count;
+	}
+
+	/* no more hashing from here on */
+	aoc_free_lut(graph->ids);
+	graph->ids = NULL;
+	return closed;
+}
+
+static stone_count_t stone_count_add(stone_count_t a, stone_count_t b)
+{
+#if STONE_MODULUS != 0
+	return (a + b) % STONE_MODULUS;
+#else
+	stone_count_t sum;
+	if (__builtin_add_overflow(a, b, &sum))
+		aoc_die(-1, "stone count overflows 128 bits, set a modulus\n");
+	return sum;
+#endif
+}
+
+/* one blink as a sparse matrix vector product: every stone hands its
+ * count on to each of its children. */
+static void blink(struct stone_graph *graph, const stone_count_t *counts,
+	stone_count_t *next)
+{
+	size_t id;
+	size_t i;
+	for (id = 0; id < graph->node_count; id++) {
+		next[id] = 0;
+	}
+	for (id = 0; id < graph->node_count; id++) {
+		if (counts[id] == 0)
 			continue;
+		for (i = graph->child_start[id]; i < graph->child_start[id + 1];
+			i++) {
+			size_t child = graph->children[i];
+			next[child] = stone_count_add(next[child], counts[id]);
 		}
-		
-		/* rule 3: if none of the rules apply, multiply by 2024 */
-		stone->value = stone->value * 2024;
 	}
 	return;
 }
 
-#if 0
-static void print_stone_list(struct aoc_dlist_node *stone_list)
+static stone_count_t sum_stone_counts(struct stone_graph *graph,
+	const stone_count_t *counts)
 {
-	struct aoc_dlist_node *ptr;
-	for (ptr = stone_list->next; ptr != stone_list; ptr = ptr->next) {
-		struct stone *stone;
-		stone = aoc_dlist_container(ptr, offsetof(struct stone, link));
-		printf("%lu ", stone->value);
-		fflush(stdout);
+	stone_count_t count = 0;
+	size_t id;
+	for (id = 0; id < graph->node_count; id++) {
+		count = stone_count_add(count, counts[id]);
 	}
-	printf("\n");
-	return;
+	return count;
 }
-#endif
 
-static void release_stone_list(struct aoc_dlist_node *stone_list)
+static uint64_t smallest_prime_factor(uint64_t n)
+{
+	uint64_t d;
+	for (d = 2; d * d <= n; d++) {
+		if (n % d == 0)
+			return d;
+	}
+	return n;
+}
+
+static bool modulus_is_squarefree(uint64_t modulus)
+{
+	while (modulus > 1) {
+		uint64_t prime = smallest_prime_factor(modulus);
+		modulus /= prime;
+		if (modulus % prime == 0)
+			return false;
+	}
+	return true;
+}
+
+static uint64_t pow_mod(uint64_t base, uint64_t exponent, uint64_t modulus)
+{
+	uint64_t result = 1;
+	base %= modulus;
+	while (exponent > 0) {
+		if (exponent & 1)
+			result = result * base % modulus;
+		base = base * base % modulus;
+		exponent >>= 1;
+	}
+	return result;
+}
+
+/* shortest linear recurrence s[n] = rec[1] s[n - 1] + ... + rec[len] s[n - len]
+ * generating the first term_count terms, modulo a prime. rec needs room
+ * for term_count + 1 coefficients. returns len. */
+static size_t berlekamp_massey(const uint64_t *s, size_t term_count,
+	uint64_t *rec, uint64_t modulus)
+{
+	uint64_t *c;
+	uint64_t *b;
+	uint64_t *t;
+	uint64_t last_d = 1;
+	size_t len = 0;
+	size_t shift = 1;
+	size_t n;
+	size_t i;
+
+	c = calloc(term_count + 1, sizeof * c);
+	b = calloc(term_count + 1, sizeof * b);
+	t = malloc((term_count + 1) * sizeof * t);
+	assert(c != NULL && b != NULL && t != NULL);
+	c[0] = b[0] = 1;
+
+	for (n = 0; n < term_count; n++) {
+		uint64_t d = s[n];
+		uint64_t coef;
+		for (i = 1; i <= len; i++) {
+			d = (d + c[i] * s[n - i]) % modulus;
+		}
+		if (d == 0) {
+			shift += 1;
+			continue;
+		}
+
+		/* c(x) -= d / last_d * x^shift * b(x) */
+		coef = d * pow_mod(last_d, modulus - 2, modulus) % modulus;
+		for (i = 0; i <= len; i++) {
+			t[i] = c[i];
+		}
+		for (i = 0; i + shift <= term_count; i++) {
+			c[i + shift] = (c[i + shift] + modulus -
+				coef * b[i] % modulus) % modulus;
+		}
+		if (2 * len <= n) {
+			size_t old_len = len;
+			len = n + 1 - len;
+			for (i = 0; i <= old_len; i++) {
+				b[i] = t[i];
+			}
+			for (; i <= term_count; i++) {
+				b[i] = 0;
+			}
+			last_d = d;
+			shift = 1;
+		} else {
+			shift += 1;
+		}
+	}
+
+	for (i = 1; i <= len; i++) {
+		rec[i] = (modulus - c[i]) % modulus;
+	}
+	free(t);
+	free(b);
+	free(c);
+	return len;
+}
+
+/* reduce a polynomial of degree up to 2 * len - 2 modulo the recurrence,
+ * x^len = rec[1] x^(len - 1) + ... + rec[len]. coefficients stay below
+ * 2^32, so products are summed in 128 bits and reduced once. */
+static void reduce_by_recurrence(stone_count_t *acc, size_t degree,
+	const uint64_t *rec, size_t len, uint64_t *out, uint64_t modulus)
 {
-	struct aoc_dlist_node *tmp;
-	assert(stone_list != NULL);
-	for (tmp = stone_list->next; tmp != stone_list; ) {
-		struct stone *stone;
-		stone = aoc_dlist_container(tmp, offsetof(struct stone, link));
-		tmp = stone->link.next;
-		free(stone);
+	size_t k;
+	size_t i;
+	for (k = degree; k >= len; k--) {
+		uint64_t v = acc[k] % modulus;
+		for (i = 1; i <= len; i++) {
+			acc[k - i] += (stone_count_t)(v * rec[i]);
+		}
+	}
+	for (i = 0; i < len; i++) {
+		out[i] = acc[i] % modulus;
 	}
 	return;
 }
 
-static int count_stones(struct aoc_dlist_node *stone_list)
+/* the sum of terms after blink_count blinks modulo a prime. the counts
+ * summed over the closed stone set follow a linear recurrence no longer
+ * than the number of stones (cayley-hamilton on the transition matrix),
+ * found from the first 2 * node_count blinks. raising the transition
+ * operator to the blink count then is repeated squaring of x modulo the
+ * recurrence polynomial. */
+static uint64_t fast_forward_prime(const uint64_t *terms, size_t term_count,
+	unsigned long long blink_count, uint64_t prime)
 {
-	int count = 0;
-	struct aoc_dlist_node *tmp;
-	assert(stone_list != NULL);
-	for (tmp = stone_list->next; tmp != stone_list; tmp = tmp->next) {
-		count += 1;
+	uint64_t *s;
+	uint64_t *rec;
+	uint64_t *poly;
+	stone_count_t *acc;
+	uint64_t count = 0;
+	size_t len;
+	size_t n;
+	size_t i;
+	size_t j;
+	int bit;
+
+	s = malloc(term_count * sizeof * s);
+	rec = calloc(term_count + 1, sizeof * rec);
+	assert(s != NULL && rec != NULL);
+	for (n = 0; n < term_count; n++) {
+		s[n] = terms[n] % prime;
 	}
+
+	len = berlekamp_massey(s, term_count, rec, prime);
+	if (len == 0)
+		goto out;
+
+	poly = calloc(len, sizeof * poly);
+	acc = malloc(2 * len * sizeof * acc);
+	assert(poly != NULL && acc != NULL);
+
+	/* poly = x^blink_count mod the recurrence, msb first */
+	poly[0] = 1;
+	for (bit = 63; bit >= 0; bit--) {
+		for (i = 0; i < 2 * len; i++) {
+			acc[i] = 0;
+		}
+		for (i = 0; i < len; i++) {
+			if (poly[i] == 0)
+				continue;
+			for (j = 0; j < len; j++) {
+				acc[i + j] += (stone_count_t)(poly[i] * poly[j]);
+			}
+		}
+		if ((blink_count >> bit) & 1) {
+			/* multiply by x */
+			for (i = 2 * len - 1; i > 0; i--) {
+				acc[i] = acc[i - 1];
+			}
+			acc[0] = 0;
+			reduce_by_recurrence(acc, 2 * len - 1, rec, len, poly,
+				prime);
+		} else if (len > 1) {
+			reduce_by_recurrence(acc, 2 * len - 2, rec, len, poly,
+				prime);
+		} else {
+			poly[0] = acc[0] % prime;
+		}
+	}
+
+	for (i = 0; i < len; i++) {
+		count = (count + poly[i] * s[i]) % prime;
+	}
+	free(acc);
+	free(poly);
+out:
+	free(rec);
+	free(s);
 	return count;
 }
 
-int main(void)
+/* the stone count after blink_count blinks, without blinking that many
+ * times. berlekamp-massey needs a field, so the count is fast-forwarded
+ * modulo every prime factor of the modulus on its own, and the results are
+ * put back together with the chinese remainder theorem. that takes a
+ * squarefree modulus, whose prime factors are pairwise coprime. */
+static stone_count_t fast_forward_stones(struct stone_graph *graph,
+	stone_count_t *counts, stone_count_t *next,
+	unsigned long long blink_count)
 {
-	struct aoc_lncache *lncache;
-	struct aoc_line *line;
-	int blink_count = 25;
-	int stone_count;
-
-	lncache = aoc_new_lncache("input");
-	if (aoc_lncache_getline(lncache, &line, 0) != -1) {
-		struct aoc_dlist_node stone_list;
-		aoc_dlist_init(&stone_list);
-		init_stone_list(&stone_list, line);
-		while(blink_count) {
-			blink(&stone_list);
-			blink_count -= 1;
+	size_t term_count = 2 * graph->node_count;
+	uint64_t rest = STONE_MODULUS;
+	uint64_t combined = 0;
+	uint64_t combined_modulus = 1;
+	uint64_t *terms;
+	size_t n;
+
+	assert(modulus_is_squarefree(STONE_MODULUS) == true);
+	terms = malloc(term_count * sizeof * terms);
+	assert(terms != NULL);
+	for (n = 0; n < term_count; n++) {
+		stone_count_t *tmp;
+		terms[n] = sum_stone_counts(graph, counts);
+		blink(graph, counts, next);
+		tmp = counts;
+		counts = next;
+		next = tmp;
+	}
+
+	while (rest > 1) {
+		uint64_t prime = smallest_prime_factor(rest);
+		uint64_t residue;
+		uint64_t k;
+		rest /= prime;
+		residue = fast_forward_prime(terms, term_count, blink_count,
+			prime);
+
+		/* combined + combined_modulus * k = residue mod prime */
+		k = (residue + prime - combined % prime) % prime;
+		k = k * pow_mod(combined_modulus, prime - 2, prime) % prime;
+		combined += combined_modulus * k;
+		combined_modulus *= prime;
+	}
+	free(terms);
+	return combined;
+}
+
+/* the initial stones are the first ids of the graph; repeated values
+ * share an id. the line and the ids of its stones are read into arrays
+ * that grow as needed. returns the number of stones on the line. */
+static size_t init_stone_graph_from_input(struct stone_graph *graph,
+	FILE *input, size_t **stone_ids)
+{
+	char *line = NULL;
+	size_t line_size = 0;
+	char *endptr;
+	size_t stone_count = 0;
+	size_t stone_size = 0;
+
+	*stone_ids = NULL;
+	if (getline(&line, &line_size, input) == -1)
+		aoc_die(-1, "cannot read the stones\n");
+	endptr = line;
+	for (;;) {
+		char *start = endptr;
+		unsigned long value;
+		value = strtoul(start, &endptr, 10);
+		if (endptr == start)
+			break;
+		if (stone_count == stone_size) {
+			stone_size = stone_size ? stone_size * 2 : STONE_IDS_SIZE;
+			*stone_ids = realloc(*stone_ids,
+				stone_size * sizeof ** stone_ids);
+			assert(*stone_ids != NULL);
 		}
-		stone_count = count_stones(&stone_list);
-		printf("stone count: %d\n", stone_count);
-		release_stone_list(&stone_list);
+		(*stone_ids)[stone_count] = stone_graph_id(graph, value);
+		stone_count += 1;
 	}
-	aoc_free_lncache(lncache);
-	return 0;
+	free(line);
+	return stone_count;
 }
 
+static stone_count_t count_stones(struct stone_graph *graph,
+	const size_t *stone_ids, size_t stone_count,
+	unsigned long long blink_count, bool closed)
+{
+	stone_count_t *counts;
+	stone_count_t *next;
+	stone_count_t count;
+	unsigned long long blink_i;
+	size_t i;
+
+	counts = calloc(graph->node_count, sizeof * counts);
+	assert(counts != NULL);
+	next = calloc(graph->node_count, sizeof * next);
+	assert(next != NULL);
+	for (i = 0; i < stone_count; i++) {
+		counts[stone_ids[i]] = stone_count_add(counts[stone_ids[i]], 1);
+	}
+
+	/* blinking beats finding the recurrence unless there are many more
+	 * blinks than stones */
+	if ((STONE_MODULUS != 0) && (closed == true) &&
+		(blink_count > 2 * graph->node_count)) {
+		if (modulus_is_squarefree(STONE_MODULUS) == true) {
+			count = fast_forward_stones(graph, counts, next,
+				blink_count);
+			free(next);
+			free(counts);
+			return count;
+		}
+		if (blink_count > STONE_BLINK_MAX)
+			aoc_die(-1, "%llu blinks need a modulus without repeated "
+				"prime factors\n", blink_count);
+	}
+
+	for (blink_i = 0; blink_i < blink_count; blink_i += 1) {
+		stone_count_t *tmp;
+		blink(graph, counts, next);
+		tmp = counts;
+		counts = next;
+		next = tmp;
+	}
+
+	count = sum_stone_counts(graph, counts);
+	free(next);
+	free(counts);
+	return count;
+}
+
+static void print_stone_count(stone_count_t count)
+{
+	char digits[40];
+	int i = sizeof digits - 1;
+	digits[i] = '\0';
+	do {
+		i -= 1;
+		digits[i] = '0' + (int)(count % 10);
+		count /= 10;
+	} while (count != 0);
+	printf("stone count: %s\n", &digits[i]);
+	return;
+}
+
+int main(void)
+{
+	FILE *input;
+	struct stone_graph graph;
+	size_t *stone_ids;
+	size_t stone_count;
+	unsigned long long blink_count = BLINK_COUNT;
+	stone_count_t count;
+	bool closed;
+
+	if ((input = fopen("input", "r")) == NULL)
+		aoc_die(-1, "cannot open input file\n");
+	init_stone_graph(&graph);
+	stone_count = init_stone_graph_from_input(&graph, input, &stone_ids);
+	fclose(input);
+	closed = compile_stone_graph(&graph, blink_count);
+	count = count_stones(&graph, stone_ids, stone_count, blink_count,
+		closed);
+	print_stone_count(count);
+	free(stone_ids);
+	release_stone_graph(&graph);
+	return 0;
+}
@@ -2,10 +2,30 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <stdbool.h>
+#include <limits.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <unistd.h>
 
-#include <aoc/lncache.h>
-#include <aoc/dlist.h>
 #include <aoc/lut.h>
+#include <aoc/die.h>
+
+#ifndef BLINK_COUNT
+#define BLINK_COUNT	75ULL
+#endif
+
+/* when non-zero, stones are counted modulo STONE_MODULUS */
+#ifndef STONE_MODULUS
+#define STONE_MODULUS	0ULL
+#endif
+#if STONE_MODULUS > 0xFFFFFFFF
+#error "STONE_MODULUS must fit 32 bits"
+#endif
+
+/* more blinks than this are only counted by fast-forwarding */
+#define STONE_BLINK_MAX	(1ULL << 20)
+
+typedef unsigned __int128 stone_count_t;
 
 static int value_digit_n(unsigned long value)
 {
@@ -50,110 +70,741 @@ static void split_stone(unsigned long value, unsigned long *value1,
 	return;
 }
 
-static void add_stone(struct aoc_lut *lut, unsigned long key, 
-	unsigned long count)
+/* every stone value met so far gets a dense id. the values a stone turns
+ * into on a blink are kept in compressed sparse row form: the children of
+ * stone id are children[child_start[id]] up to children[child_start[id + 1]].
+ * the lut from value to id is only needed while the graph is compiled. */
+struct stone_graph {
+#define STONE_GRAPH_SIZE	1024
+#define STONE_IDS_SIZE		1024
+	unsigned long *values;
+	size_t *child_start;
+	size_t node_count;
+	size_t node_size;
+	size_t *children;
+	size_t child_count;
+	size_t child_size;
+	struct aoc_lut *ids;
+};
+
+static void init_stone_graph(struct stone_graph *graph)
+{
+	graph->values = NULL;
+	graph->child_start = NULL;
+	graph->node_count = 0;
+	graph->node_size = 0;
+	graph->children = NULL;
+	graph->child_count = 0;
+	graph->child_size = 0;
+	graph->ids = aoc_new_lut(12, sizeof(unsigned long), sizeof(size_t));
+	assert(graph->ids != NULL);
+	return;
+}
+
+static void release_stone_graph(struct stone_graph *graph)
 {
-	unsigned long old_count;
-	if (aoc_lut_lookup(lut, &key, sizeof key, &old_count, sizeof old_count) == 0) {
-		/* we already have this stone, remove it 
-		 * so we can update it and put it back */
-		aoc_lut_remove(lut, &key, sizeof key);
-		count += old_count;
+	free(graph->values);
+	free(graph->child_start);
+	free(graph->children);
+	if (graph->ids != NULL)
+		aoc_free_lut(graph->ids);
+	return;
+}
+
+/* id of a stone value, handing out the next id to values not seen yet */
+static size_t stone_graph_id(struct stone_graph *graph, unsigned long value)
+{
+	size_t id;
+	if (aoc_lut_lookup(graph->ids, &value, sizeof value, &id, sizeof id) == 0)
+		return id;
+
+	if (graph->node_count == graph->node_size) {
+		graph->node_size = graph->node_size ? graph->node_size * 2 :
+			STONE_GRAPH_SIZE;
+		graph->values = realloc(graph->values,
+			graph->node_size * sizeof * graph->values);
+		assert(graph->values != NULL);
+		graph->child_start = realloc(graph->child_start,
+			(graph->node_size + 1) * sizeof * graph->child_start);
+		assert(graph->child_start != NULL);
 	}
+	id = graph->node_count;
+	graph->values[id] = value;
+	graph->node_count += 1;
+	assert(aoc_lut_add(graph->ids, &value, sizeof value, &id, sizeof id) == 0);
+	return id;
+}
 
-	/* now we can add our stone again to the lut */
-	assert(aoc_lut_add(lut, &key, sizeof key, &count, sizeof count) == 0);
+static void stone_graph_add_child(struct stone_graph *graph,
+	unsigned long value)
+{
+	size_t id = stone_graph_id(graph, value);
+	if (graph->child_count == graph->child_size) {
+		graph->child_size = graph->child_size ? graph->child_size * 2 :
+			STONE_GRAPH_SIZE;
+		graph->children = realloc(graph->children,
+			graph->child_size * sizeof * graph->children);
+		assert(graph->children != NULL);
+	}
+	graph->children[graph->child_count] = id;
+	graph->child_count += 1;
 	return;
 }
 
-/* process this stone according to the rules.
- * add new stones to the spare_lut as necessary */
-void process_stone(const void *_key, const void *_data, void *cb_param) //struct aoc_lut *spare_lut)
+/* apply the rules to a stone, recording the stones it turns into */
+static void stone_graph_expand(struct stone_graph *graph, size_t id)
 {
-	unsigned long key = *((const unsigned long *)_key);
-	const unsigned long count = *((const unsigned long *)_data);
-	struct aoc_lut *spare_lut = (struct aoc_lut *)cb_param;
-	if (key == 0) {
-		add_stone(spare_lut, 1, count);
-	} else if (stone_has_even_digits(key) == true) {
+	unsigned long value = graph->values[id];
+	graph->child_start[id] = graph->child_count;
+	if (value == 0) {
+		stone_graph_add_child(graph, 1);
+	} else if (stone_has_even_digits(value) == true) {
 		unsigned long value1;
 		unsigned long value2;
-		split_stone(key, &value1, &value2);
-		add_stone(spare_lut, value1, count);
-		add_stone(spare_lut, value2, count);
+		split_stone(value, &value1, &value2);
+		stone_graph_add_child(graph, value1);
+		stone_graph_add_child(graph, value2);
 	} else {
-		add_stone(spare_lut, key * 2024, count);
+		assert(value <= ULONG_MAX / 2024);
+		stone_graph_add_child(graph, value * 2024);
 	}
 	return;
 }
 
-static struct aoc_lut *blink(struct aoc_lut *active_lut)
+/* expand the stones reachable within depth blinks from the stones that
+ * are in the graph already, level by level. the set of values reached
+ * closes after a few thousand stones, which usually ends the walk long
+ * before depth does. stones on the last level keep no children.
+ * returns true if the graph is closed, every stone being expanded. */
+static bool compile_stone_graph(struct stone_graph *graph,
+	unsigned long long depth)
 {
-	struct aoc_lut *spare_lut;
-	spare_lut = aoc_new_lut(12, sizeof(unsigned long), sizeof(unsigned long));
-	assert(spare_lut != NULL);
-	aoc_lut_foreach(active_lut, process_stone, spare_lut);
-	return spare_lut;
+	size_t level_end = graph->node_count;
+	size_t id;
+	bool closed;
+	for (id = 0; id < graph->node_count; id++) {
+		if (id == level_end) {
+			depth -= 1;
+			level_end = graph->node_count;
+		}
+		if (depth == 0)
+			break;
+		stone_graph_expand(graph, id);
+	}
+	closed = (id == graph->node_count);
+	for (; id <= graph->node_count; id++) {
+		graph->child_start[id] = graph->child_count;
+	}
+
+	/* no more hashing from here on */
+	aoc_free_lut(graph->ids);
+	graph->ids = NULL;
+	return closed;
+}
+
+static stone_count_t stone_count_add(stone_count_t a, stone_count_t b)
+{
+#if STONE_MODULUS != 0
+	return (a + b) % STONE_MODULUS;
+#else
+	stone_count_t sum;
+	if (__builtin_add_overflow(a, b, &sum))
+		aoc_die(-1, "stone count overflows 128 bits, set a modulus\n");
+	return sum;
+#endif
 }
 
-static void init_stone_lut(struct aoc_lut *lut,	struct aoc_line *line)
+/* one blink as a sparse matrix vector product: every stone hands its
+ * count on to each of its children. */
+static void blink(struct stone_graph *graph, const stone_count_t *counts,
+	stone_count_t *next)
 {
-	char buffer[1024];
-	char *endptr = buffer;
-	unsigned long value;
-	assert(aoc_line_strlen(line) <= sizeof buffer);
-	aoc_line_get(line, buffer, sizeof buffer);
-	while(*endptr != '\0') {
-		value = strtoul(endptr, &endptr, 10);
-		add_stone(lut, value, 1);
-		if (*endptr == ' ')
-			endptr += 1;
+	size_t id;
+	size_t i;
+	for (id = 0; id < graph->node_count; id++) {
+		next[id] = 0;
+	}
+	for (id = 0; id < graph->node_count; id++) {
+		if (counts[id] == 0)
+			continue;
+		for (i = graph->child_start[id]; i < graph->child_start[id + 1];
+			i++) {
+			size_t child = graph->children[i];
+			next[child] = stone_count_add(next[child], counts[id]);
+		}
 	}
 	return;
 }
 
-static void node_count_stone(const void *key, const void *data, void *param)
+static stone_count_t sum_stone_counts(struct stone_graph *graph,
+	const stone_count_t *counts)
+{
+	stone_count_t count = 0;
+	size_t id;
+	for (id = 0; id < graph->node_count; id++) {
+		count = stone_count_add(count, counts[id]);
+	}
+	return count;
+}
+
+static uint64_t smallest_prime_factor(uint64_t n)
+{
+	uint64_t d;
+	for (d = 2; d * d <= n; d++) {
+		if (n % d == 0)
+			return d;
+	}
+	return n;
+}
+
+static bool modulus_is_squarefree(uint64_t modulus)
 {
-	unsigned long count;
-	unsigned long *update;
-	(void)key;
+	while (modulus > 1) {
+		uint64_t prime = smallest_prime_factor(modulus);
+		modulus /= prime;
+		if (modulus % prime == 0)
+			return false;
+	}
+	return true;
+}
+
+static uint64_t pow_mod(uint64_t base, uint64_t exponent, uint64_t modulus)
+{
+	uint64_t result = 1;
+	base %= modulus;
+	while (exponent > 0) {
+		if (exponent & 1)
+			result = result * base % modulus;
+		base = base * base % modulus;
+		exponent >>= 1;
+	}
+	return result;
+}
+
+/* shortest linear recurrence s[n] = rec[1] s[n - 1] + ... + rec[len] s[n - len]
+ * generating the first term_count terms, modulo a prime. rec needs room
+ * for term_count + 1 coefficients. returns len. */
+static size_t berlekamp_massey(const uint64_t *s, size_t term_count,
+	uint64_t *rec, uint64_t modulus)
+{
+	uint64_t *c;
+	uint64_t *b;
+	uint64_t *t;
+	uint64_t last_d = 1;
+	size_t len = 0;
+	size_t shift = 1;
+	size_t n;
+	size_t i;
 
-	update = (unsigned long *)param;
-	count = *(const unsigned long *)data;
-	*update += count;
+	c = calloc(term_count + 1, sizeof * c);
+	b = calloc(term_count + 1, sizeof * b);
+	t = malloc((term_count + 1) * sizeof * t);
+	assert(c != NULL && b != NULL && t != NULL);
+	c[0] = b[0] = 1;
+
+	for (n = 0; n < term_count; n++) {
+		uint64_t d = s[n];
+		uint64_t coef;
+		for (i = 1; i <= len; i++) {
+			d = (d + c[i] * s[n - i]) % modulus;
+		}
+		if (d == 0) {
+			shift += 1;
+			continue;
+		}
+
+		/* c(x) -= d / last_d * x^shift * b(x) */
+		coef = d * pow_mod(last_d, modulus - 2, modulus) % modulus;
+		for (i = 0; i <= len; i++) {
+			t[i] = c[i];
+		}
+		for (i = 0; i + shift <= term_count; i++) {
+			c[i + shift] = (c[i + shift] + modulus -
+				coef * b[i] % modulus) % modulus;
+		}
+		if (2 * len <= n) {
+			size_t old_len = len;
+			len = n + 1 - len;
+			for (i = 0; i <= old_len; i++) {
+				b[i] = t[i];
+			}
+			for (; i <= term_count; i++) {
+				b[i] = 0;
+			}
+			last_d = d;
+			shift = 1;
+		} else {
+			shift += 1;
+		}
+	}
+
+	for (i = 1; i <= len; i++) {
+		rec[i] = (modulus - c[i]) % modulus;
+	}
+	free(t);
+	free(b);
+	free(c);
+	return len;
+}
+
+/* reduce a polynomial of degree up to 2 * len - 2 modulo the recurrence,
+ * x^len = rec[1] x^(len - 1) + ... + rec[len]. coefficients stay below
+ * 2^32, so products are summed in 128 bits and reduced once. */
+static void reduce_by_recurrence(stone_count_t *acc, size_t degree,
+	const uint64_t *rec, size_t len, uint64_t *out, uint64_t modulus)
+{
+	size_t k;
+	size_t i;
+	for (k = degree; k >= len; k--) {
+		uint64_t v = acc[k] % modulus;
+		for (i = 1; i <= len; i++) {
+			acc[k - i] += (stone_count_t)(v * rec[i]);
+		}
+	}
+	for (i = 0; i < len; i++) {
+		out[i] = acc[i] % modulus;
+	}
 	return;
 }
 
-static unsigned long count_stones(struct aoc_lut *lut)
+/* the sum of terms after blink_count blinks modulo a prime. the counts
+ * summed over the closed stone set follow a linear recurrence no longer
+ * than the number of stones (cayley-hamilton on the transition matrix),
+ * found from the first 2 * node_count blinks. raising the transition
+ * operator to the blink count then is repeated squaring of x modulo the
+ * recurrence polynomial. */
+static uint64_t fast_forward_prime(const uint64_t *terms, size_t term_count,
+	unsigned long long blink_count, uint64_t prime)
 {
-	unsigned long count = 0;
-	aoc_lut_foreach(lut, node_count_stone, &count);
+	uint64_t *s;
+	uint64_t *rec;
+	uint64_t *poly;
+	stone_count_t *acc;
+	uint64_t count = 0;
+	size_t len;
+	size_t n;
+	size_t i;
+	size_t j;
+	int bit;
+
+	s = malloc(term_count * sizeof * s);
+	rec = calloc(term_count + 1, sizeof * rec);
+	assert(s != NULL && rec != NULL);
+	for (n = 0; n < term_count; n++) {
+		s[n] = terms[n] % prime;
+	}
+
+	len = berlekamp_massey(s, term_count, rec, prime);
+	if (len == 0)
+		goto out;
+
+	poly = calloc(len, sizeof * poly);
+	acc = malloc(2 * len * sizeof * acc);
+	assert(poly != NULL && acc != NULL);
+
+	/* poly = x^blink_count mod the recurrence, msb first */
+	poly[0] = 1;
+	for (bit = 63; bit >= 0; bit--) {
+		for (i = 0; i < 2 * len; i++) {
+			acc[i] = 0;
+		}
+		for (i = 0; i < len; i++) {
+			if (poly[i] == 0)
+				continue;
+			for (j = 0; j < len; j++) {
+				acc[i + j] += (stone_count_t)(poly[i] * poly[j]);
+			}
+		}
+		if ((blink_count >> bit) & 1) {
+			/* multiply by x */
+			for (i = 2 * len - 1; i > 0; i--) {
+				acc[i] = acc[i - 1];
+			}
+			acc[0] = 0;
+			reduce_by_recurrence(acc, 2 * len - 1, rec, len, poly,
+				prime);
+		} else if (len > 1) {
+			reduce_by_recurrence(acc, 2 * len - 2, rec, len, poly,
+				prime);
+		} else {
+			poly[0] = acc[0] % prime;
+		}
+	}
+
+	for (i = 0; i < len; i++) {
+		count = (count + poly[i] * s[i]) % prime;
+	}
+	free(acc);
+	free(poly);
+out:
+	free(rec);
+	free(s);
 	return count;
 }
 
-int main(void)
+/* the stone count after blink_count blinks, without blinking that many
+ * times. berlekamp-massey needs a field, so the count is fast-forwarded
+ * modulo every prime factor of the modulus on its own, and the results are
+ * put back together with the chinese remainder theorem. that takes a
+ * squarefree modulus, whose prime factors are pairwise coprime. */
+static stone_count_t fast_forward_stones(struct stone_graph *graph,
+	stone_count_t *counts, stone_count_t *next,
+	unsigned long long blink_count)
 {
-	struct aoc_lncache *lncache;
-	struct aoc_line *line;
-	struct aoc_lut *lut;
-	int blink_i;
-	unsigned long count;
-
-	assert((lncache = aoc_new_lncache("input")) != NULL);
-	assert(aoc_lncache_getline(lncache, &line, 0) != -1);
-	assert((lut = aoc_new_lut(2, sizeof(unsigned long), sizeof(unsigned long))) != NULL);
-	init_stone_lut(lut, line);
-	for (blink_i = 0; blink_i < 75; blink_i +=1) {
-		struct aoc_lut *tmp;
-		tmp = blink(lut);
-		aoc_free_lut(lut);
-		lut = tmp;
-	}
-	count = count_stones(lut);
-	printf("stone count: %lu\n", count);
-	aoc_free_lut(lut);
-	aoc_free_lncache(lncache);
-	return 0;
+	size_t term_count = 2 * graph->node_count;
+	uint64_t rest = STONE_MODULUS;
+	uint64_t combined = 0;
+	uint64_t combined_modulus = 1;
+	uint64_t *terms;
+	size_t n;
+
+	assert(modulus_is_squarefree(STONE_MODULUS) == true);
+	terms = malloc(term_count * sizeof * terms);
+	assert(terms != NULL);
+	for (n = 0; n < term_count; n++) {
+		stone_count_t *tmp;
+		terms[n] = sum_stone_counts(graph, counts);
+		blink(graph, counts, next);
+		tmp = counts;
+		counts = next;
+		next = tmp;
+	}
+
+	while (rest > 1) {
+		uint64_t prime = smallest_prime_factor(rest);
+		uint64_t residue;
+		uint64_t k;
+		rest /= prime;
+		residue = fast_forward_prime(terms, term_count, blink_count,
+			prime);
+
+		/* combined + combined_modulus * k = residue mod prime */
+		k = (residue + prime - combined % prime) % prime;
+		k = k * pow_mod(combined_modulus, prime - 2, prime) % prime;
+		combined += combined_modulus * k;
+		combined_modulus *= prime;
+	}
+	free(terms);
+	return combined;
 }
 
+/* the initial stones are the first ids of the graph; repeated values
+ * share an id. the line and the ids of its stones are read into arrays
+ * that grow as needed. returns the number of stones on the line. */
+static size_t init_stone_graph_from_input(struct stone_graph *graph,
+	FILE *input, size_t **stone_ids)
+{
+	char *line = NULL;
+	size_t line_size = 0;
+	char *endptr;
+	size_t stone_count = 0;
+	size_t stone_size = 0;
+
+	*stone_ids = NULL;
+	if (getline(&line, &line_size, input) == -1)
+		aoc_die(-1, "cannot read the stones\n");
+	endptr = line;
+	for (;;) {
+		char *start = endptr;
+		unsigned long value;
+		value = strtoul(start, &endptr, 10);
+		if (endptr == start)
+			break;
+		if (stone_count == stone_size) {
+			stone_size = stone_size ? stone_size * 2 : STONE_IDS_SIZE;
+			*stone_ids = realloc(*stone_ids,
+				stone_size * sizeof ** stone_ids);
+			assert(*stone_ids != NULL);
+		}
+		(*stone_ids)[stone_count] = stone_graph_id(graph, value);
+		stone_count += 1;
+	}
+	free(line);
+	return stone_count;
+}
+
+/* blinking in parallel. the stone ids are cut into one contiguous shard
+ * per worker. on every blink a worker expands the stones of its shard and
+ * routes each (child, count) contribution into a buffer for the shard that
+ * owns the child. after everyone is done, a worker clears the ids of its
+ * own shard in the next generation and adds up the contributions routed to
+ * it, in worker order. every entry has a single writer so no locks are
+ * needed, and no worker clears or sums ids outside its own shard. */
+struct stone_contribution {
+	size_t child;
+	stone_count_t count;
+};
+
+struct blink_route {
+	struct stone_contribution *entries;
+	size_t count;
+};
+
+struct blink_job {
+#define STONE_SHARD_MIN	1024
+	struct stone_graph *graph;
+	stone_count_t *counts;
+	stone_count_t *next;
+	struct blink_route *routes; /* nr_workers x nr_workers, by source */
+	unsigned long long blink_count;
+	int nr_workers;
+	pthread_barrier_t barrier;
+};
+
+struct blink_worker {
+	pthread_t thread;
+	struct blink_job *job;
+	int id;
+	size_t first; /* ids [first, last) make up our shard */
+	size_t last;
+};
+
+/* the worker whose shard holds id, the inverse of the shard bounds */
+static int shard_of(size_t id, size_t node_count, int nr_workers)
+{
+	return (int)(((id + 1) * nr_workers - 1) / node_count);
+}
+
+/* size our outgoing routes for every edge leaving the shard, the
+ * graph never changes so they will not need to grow later */
+static void init_blink_routes(struct blink_worker *worker,
+	struct blink_route *routes)
+{
+	struct blink_job *job = worker->job;
+	struct stone_graph *graph = job->graph;
+	size_t *sizes;
+	size_t i;
+	int w;
+
+	sizes = calloc(job->nr_workers, sizeof * sizes);
+	assert(sizes != NULL);
+	for (i = graph->child_start[worker->first];
+		i < graph->child_start[worker->last]; i++) {
+		sizes[shard_of(graph->children[i], graph->node_count,
+			job->nr_workers)] += 1;
+	}
+	for (w = 0; w < job->nr_workers; w++) {
+		routes[w].entries = malloc((sizes[w] + 1)
+			* sizeof * routes[w].entries);
+		assert(routes[w].entries != NULL);
+		routes[w].count = 0;
+	}
+	free(sizes);
+	return;
+}
+
+static void *blink_worker_run(void *param)
+{
+	struct blink_worker *worker = param;
+	struct blink_job *job = worker->job;
+	struct stone_graph *graph = job->graph;
+	struct blink_route *routes = &job->routes[worker->id * job->nr_workers];
+	stone_count_t *counts = job->counts;
+	stone_count_t *next = job->next;
+	unsigned long long blink_i;
+	size_t id;
+	size_t i;
+	int w;
+
+	init_blink_routes(worker, routes);
+	for (blink_i = 0; blink_i < job->blink_count; blink_i += 1) {
+		stone_count_t *tmp;
+
+		for (w = 0; w < job->nr_workers; w++) {
+			routes[w].count = 0;
+		}
+		for (id = worker->first; id < worker->last; id++) {
+			if (counts[id] == 0)
+				continue;
+			for (i = graph->child_start[id];
+				i < graph->child_start[id + 1]; i++) {
+				size_t child = graph->children[i];
+				struct blink_route *route;
+				route = &routes[shard_of(child, graph->node_count,
+					job->nr_workers)];
+				route->entries[route->count].child = child;
+				route->entries[route->count].count = counts[id];
+				route->count += 1;
+			}
+		}
+		pthread_barrier_wait(&job->barrier);
+
+		for (id = worker->first; id < worker->last; id++) {
+			next[id] = 0;
+		}
+		for (w = 0; w < job->nr_workers; w++) {
+			struct blink_route *route;
+			route = &job->routes[w * job->nr_workers + worker->id];
+			for (i = 0; i < route->count; i++) {
+				size_t child = route->entries[i].child;
+				next[child] = stone_count_add(next[child],
+					route->entries[i].count);
+			}
+		}
+		pthread_barrier_wait(&job->barrier);
+
+		tmp = counts;
+		counts = next;
+		next = tmp;
+	}
+	return NULL;
+}
+
+static int worker_count(void)
+{
+	long count;
+	count = sysconf(_SC_NPROCESSORS_ONLN);
+	if (count < 1)
+		count = 1;
+	if (count > 64)
+		count = 64;
+	return (int)count;
+}
+
+/* blink blink_count times, leaving the result in counts */
+static void blink_parallel(struct stone_graph *graph, stone_count_t *counts,
+	stone_count_t *next, unsigned long long blink_count, int nr_workers)
+{
+	struct blink_job job;
+	struct blink_worker *workers;
+	size_t id;
+	int w;
+
+	job.graph = graph;
+	job.counts = counts;
+	job.next = next;
+	job.blink_count = blink_count;
+	job.nr_workers = nr_workers;
+	job.routes = malloc(nr_workers * nr_workers * sizeof * job.routes);
+	assert(job.routes != NULL);
+	assert(pthread_barrier_init(&job.barrier, NULL, nr_workers) == 0);
 
+	workers = malloc(nr_workers * sizeof * workers);
+	assert(workers != NULL);
+	for (w = 0; w < nr_workers; w++) {
+		struct blink_worker *worker = &workers[w];
+		worker->job = &job;
+		worker->id = w;
+		worker->first = graph->node_count * w / nr_workers;
+		worker->last = graph->node_count * (w + 1) / nr_workers;
+		if (pthread_create(&worker->thread, NULL, blink_worker_run,
+			worker) != 0) {
+			aoc_die(-1, "cannot create blink worker\n");
+		}
+	}
+
+	for (w = 0; w < nr_workers; w++) {
+		pthread_join(workers[w].thread, NULL);
+	}
+	for (w = 0; w < nr_workers * nr_workers; w++) {
+		free(job.routes[w].entries);
+	}
+
+	/* an odd number of blinks ends in the spare table */
+	if (blink_count & 1) {
+		for (id = 0; id < graph->node_count; id++) {
+			counts[id] = next[id];
+		}
+	}
+
+	pthread_barrier_destroy(&job.barrier);
+	free(workers);
+	free(job.routes);
+	return;
+}
+
+static stone_count_t count_stones(struct stone_graph *graph,
+	const size_t *stone_ids, size_t stone_count,
+	unsigned long long blink_count, bool closed)
+{
+	stone_count_t *counts;
+	stone_count_t *next;
+	stone_count_t count;
+	unsigned long long blink_i;
+	int nr_workers;
+	size_t i;
+
+	counts = calloc(graph->node_count, sizeof * counts);
+	assert(counts != NULL);
+	next = calloc(graph->node_count, sizeof * next);
+	assert(next != NULL);
+	for (i = 0; i < stone_count; i++) {
+		counts[stone_ids[i]] = stone_count_add(counts[stone_ids[i]], 1);
+	}
+
+	/* blinking beats finding the recurrence unless there are many more
+	 * blinks than stones */
+	if ((STONE_MODULUS != 0) && (closed == true) &&
+		(blink_count > 2 * graph->node_count)) {
+		if (modulus_is_squarefree(STONE_MODULUS) == true) {
+			count = fast_forward_stones(graph, counts, next,
+				blink_count);
+			free(next);
+			free(counts);
+			return count;
+		}
+		if (blink_count > STONE_BLINK_MAX)
+			aoc_die(-1, "%llu blinks need a modulus without repeated "
+				"prime factors\n", blink_count);
+	}
+
+	/* shards smaller than STONE_SHARD_MIN stones aren't worth a thread */
+	nr_workers = worker_count();
+	if ((size_t)nr_workers > graph->node_count / STONE_SHARD_MIN)
+		nr_workers = graph->node_count / STONE_SHARD_MIN;
+	if (nr_workers > 1) {
+		blink_parallel(graph, counts, next, blink_count, nr_workers);
+		blink_count = 0;
+	}
+
+	for (blink_i = 0; blink_i < blink_count; blink_i += 1) {
+		stone_count_t *tmp;
+		blink(graph, counts, next);
+		tmp = counts;
+		counts = next;
+		next = tmp;
+	}
+
+	count = sum_stone_counts(graph, counts);
+	free(next);
+	free(counts);
+	return count;
+}
+
+static void print_stone_count(stone_count_t count)
+{
+	char digits[40];
+	int i = sizeof digits - 1;
+	digits[i] = '\0';
+	do {
+		i -= 1;
+		digits[i] = '0' + (int)(count % 10);
+		count /= 10;
+	} while (count != 0);
+	printf("stone count: %s\n", &digits[i]);
+	return;
+}
+
+int main(void)
+{
+	FILE *input;
+	struct stone_graph graph;
+	size_t *stone_ids;
+	size_t stone_count;
+	unsigned long long blink_count = BLINK_COUNT;
+	stone_count_t count;
+	bool closed;
+
+	if ((input = fopen("input", "r")) == NULL)
+		aoc_die(-1, "cannot open input file\n");
+	init_stone_graph(&graph);
+	stone_count = init_stone_graph_from_input(&graph, input, &stone_ids);
+	fclose(input);
+	closed = compile_stone_graph(&graph, blink_count);
+	count = count_stones(&graph, stone_ids, stone_count, blink_count,
+		closed);
+	print_stone_count(count);
+	free(stone_ids);
+	release_stone_graph(&graph);
+	return 0;
+}
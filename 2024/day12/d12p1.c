@@ -2,131 +2,337 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <pthread.h>
+#include <unistd.h>
 
 #include <aoc/mapcache.h>
-#include <aoc/lut.h>
 
-static void add_garden_plot(struct aoc_lut *plot_lut, unsigned long id) 
+/* the garden copied out of the mapcache into a flat row-major array */
+struct garden_grid {
+	char *plants;
+	int width;
+	int height;
+	size_t plot_count;
+};
+
+static struct garden_grid *new_garden_grid(struct aoc_mapcache *garden)
+{
+	struct garden_grid *grid;
+	assert(garden != NULL);
+
+	grid = malloc(sizeof * grid);
+	assert(grid != NULL);
+	grid->width = aoc_mapcache_width(garden);
+	grid->height = aoc_mapcache_height(garden);
+	grid->plot_count = (size_t)grid->width * grid->height;
+	grid->plants = malloc(grid->plot_count);
+	assert(grid->plants != NULL);
+
+	aoc_mapcache_reset(garden);
+	for (;;) {
+		int plant;
+		int row;
+		int col;
+		plant = aoc_mapcache_tile(garden, NULL);
+		assert(plant != -1);
+		aoc_mapcache_coord(garden, &row, &col);
+		grid->plants[(size_t)row * grid->width + col] = (char)plant;
+		if (aoc_mapcache_walk_forward(garden) == -1)
+			break;
+	}
+	return grid;
+}
+
+static void free_garden_grid(struct garden_grid *grid)
+{
+	free(grid->plants);
+	free(grid);
+	return;
+}
+
+/* totals of every region, indexed by region id */
+struct garden_regions {
+#define GARDEN_REGIONS_SIZE	64
+	size_t *area;
+	size_t *perimeter;
+	size_t count;
+	size_t size;
+};
+
+static void init_garden_regions(struct garden_regions *regions)
+{
+	regions->area = NULL;
+	regions->perimeter = NULL;
+	regions->count = 0;
+	regions->size = 0;
+	return;
+}
+
+static void release_garden_regions(struct garden_regions *regions)
+{
+	free(regions->area);
+	free(regions->perimeter);
+	return;
+}
+
+static size_t garden_regions_new(struct garden_regions *regions)
+{
+	if (regions->count == regions->size) {
+		regions->size = regions->size ? regions->size * 2 :
+			GARDEN_REGIONS_SIZE;
+		regions->area = realloc(regions->area,
+			regions->size * sizeof * regions->area);
+		assert(regions->area != NULL);
+		regions->perimeter = realloc(regions->perimeter,
+			regions->size * sizeof * regions->perimeter);
+		assert(regions->perimeter != NULL);
+	}
+	regions->area[regions->count] = 0;
+	regions->perimeter[regions->count] = 0;
+	regions->count += 1;
+	return regions->count - 1;
+}
+
+/* labels double as the union-find forest: a plot points at a plot of its
+ * region that comes earlier in scan order, a root points at itself. */
+static size_t find_label(size_t *labels, size_t plot)
+{
+	while (labels[plot] != plot) {
+		labels[plot] = labels[labels[plot]];
+		plot = labels[plot];
+	}
+	return plot;
+}
+
+/* the root that comes first in scan order wins, so labels only ever
+ * point backwards */
+static void union_labels(size_t *labels, size_t plot1, size_t plot2)
 {
-	int err;
-	assert(plot_lut != NULL);
-	err = aoc_lut_add(plot_lut, &id, sizeof id, NULL, 0);
-	assert(err == 0);
+	plot1 = find_label(labels, plot1);
+	plot2 = find_label(labels, plot2);
+	if (plot1 < plot2)
+		labels[plot2] = plot1;
+	else if (plot2 < plot1)
+		labels[plot1] = plot2;
 	return;
 }
 
-/* remember to remove in plot lut */
-static void process_region(struct aoc_mapcache *garden, int region,
-	struct aoc_lut *plot_lut, int *area, int *perimeter)
+static bool same_plant(struct garden_grid *grid, size_t plot, int row,
+	int col)
 {
-	int err;
-	unsigned long plot_id;
-	int plant;
-	int adj_plant;
-
-	/* stop processing we have visited this plot before */
-	plant = aoc_mapcache_tile(garden, &plot_id);
-	err = aoc_lut_lookup(plot_lut, &plot_id, sizeof plot_id, NULL, 0);
-	if (err == -1) {
-		return;
+	if ((row < 0) || (row >= grid->height) ||
+		(col < 0) || (col >= grid->width))
+		return false;
+	return grid->plants[(size_t)row * grid->width + col] ==
+		grid->plants[plot];
+}
+
+/* pass 1 of the scanline labeling of the rows [first_row, last_row):
+ * every plot joins the region of its left and upper neighbours when they
+ * grow the same plant, linking the two when both do. plots above the
+ * first row are left to the merge along band borders. */
+static void label_garden(struct garden_grid *grid, size_t *labels,
+	int first_row, int last_row)
+{
+	int row;
+	int col;
+
+	for (row = first_row; row < last_row; row++) {
+		for (col = 0; col < grid->width; col++) {
+			size_t plot = (size_t)row * grid->width + col;
+			bool left = same_plant(grid, plot, row, col - 1);
+			bool up = (row > first_row) &&
+				same_plant(grid, plot, row - 1, col);
+			labels[plot] = plot;
+			if (left == true)
+				labels[plot] = labels[plot - 1];
+			if (up == true) {
+				if (left == true)
+					union_labels(labels, plot - 1,
+						plot - grid->width);
+				else
+					labels[plot] = labels[plot - grid->width];
+			}
+		}
 	}
+	return;
+}
+
+/* pass 2: give roots a region id in scan order and rewrite every label
+ * into the region id of its root. all labels point backwards, so the one
+ * a plot points at has been rewritten already. area and perimeter are
+ * added up on the way. */
+static void resolve_regions(struct garden_grid *grid, size_t *labels,
+	int first_row, int last_row, struct garden_regions *regions)
+{
+	int row;
+	int col;
+	for (row = first_row; row < last_row; row++) {
+		for (col = 0; col < grid->width; col++) {
+			size_t plot = (size_t)row * grid->width + col;
+			size_t region;
+			int fences = 0;
+
+			if (labels[plot] == plot)
+				region = garden_regions_new(regions);
+			else
+				region = labels[labels[plot]];
+			labels[plot] = region;
 
-	/* are we crossing over to a new region of plants? */
-	if (plant != region) {
-		return;
+			fences += (same_plant(grid, plot, row - 1, col) == false);
+			fences += (same_plant(grid, plot, row + 1, col) == false);
+			fences += (same_plant(grid, plot, row, col - 1) == false);
+			fences += (same_plant(grid, plot, row, col + 1) == false);
+			regions->area[region] += 1;
+			regions->perimeter[region] += fences;
+		}
 	}
+	return;
+}
+
+/* big gardens are cut into bands of whole rows, one per worker, labeled
+ * concurrently. region ids and the sums gathered for them are local to a
+ * band. regions are then merged across band borders through a union-find
+ * over all band regions, band b's region i having key base + i. */
+struct garden_band {
+#define GARDEN_BAND_ROWS	64
+	pthread_t thread;
+	struct garden_grid *grid;
+	size_t *labels;
+	int first_row;
+	int last_row;
+	struct garden_regions regions;
+	size_t base;
+};
+
+static void *garden_band_run(void *param)
+{
+	struct garden_band *band = param;
+	label_garden(band->grid, band->labels, band->first_row,
+		band->last_row);
+	resolve_regions(band->grid, band->labels, band->first_row,
+		band->last_row, &band->regions);
+	return NULL;
+}
+
+static int worker_count(void)
+{
+	long count;
+	count = sysconf(_SC_NPROCESSORS_ONLN);
+	if (count < 1)
+		count = 1;
+	if (count > 64)
+		count = 64;
+	return (int)count;
+}
 
-	/* if we reach here, we have not visited this plot before and we 
-	 * are still in the same region. */
-	aoc_lut_remove(plot_lut, &plot_id, sizeof plot_id);
-	*area += 1;
-
-	/* try go up from here */
-	adj_plant = aoc_mapcache_peek_up(garden);
-	if ((adj_plant != -1) && (adj_plant == region)) {
-		aoc_mapcache_step_up(garden);
-		process_region(garden, region, plot_lut, area, perimeter);
-		aoc_mapcache_step_down(garden);
-	} else {
-		*perimeter += 1;
+/* label the garden and sum up every region into totals. afterwards a
+ * region's totals are found under the key that is the root of its keys. */
+static void survey_garden(struct garden_grid *grid,
+	struct garden_regions *totals, size_t **keys)
+{
+	struct garden_band *bands;
+	size_t *labels;
+	int nr_bands;
+	int b;
+	int col;
+	size_t key;
+
+	/* bands thinner than GARDEN_BAND_ROWS aren't worth a thread */
+	nr_bands = worker_count();
+	if (nr_bands > grid->height / GARDEN_BAND_ROWS)
+		nr_bands = grid->height / GARDEN_BAND_ROWS;
+	if (nr_bands < 1)
+		nr_bands = 1;
+
+	labels = malloc(grid->plot_count * sizeof * labels);
+	assert(labels != NULL);
+	bands = malloc(nr_bands * sizeof * bands);
+	assert(bands != NULL);
+	for (b = 0; b < nr_bands; b++) {
+		struct garden_band *band = &bands[b];
+		band->grid = grid;
+		band->labels = labels;
+		band->first_row = (long)grid->height * b / nr_bands;
+		band->last_row = (long)grid->height * (b + 1) / nr_bands;
+		init_garden_regions(&band->regions);
+		if (pthread_create(&band->thread, NULL, garden_band_run,
+			band) != 0) {
+			fprintf(stderr, "cannot create garden worker\n");
+			exit(-1);
+		}
 	}
 
-	/* try go right from here */
-	adj_plant = aoc_mapcache_peek_right(garden);
-	if ((adj_plant != -1) && (adj_plant == region)) {
-		aoc_mapcache_step_right(garden);
-		process_region(garden, region, plot_lut, area, perimeter);
-		aoc_mapcache_step_left(garden);
-	} else {
-		*perimeter += 1;
+	/* gather the partial sums of all bands in band order */
+	init_garden_regions(totals);
+	for (b = 0; b < nr_bands; b++) {
+		struct garden_band *band = &bands[b];
+		size_t region;
+		pthread_join(band->thread, NULL);
+		band->base = totals->count;
+		for (region = 0; region < band->regions.count; region++) {
+			key = garden_regions_new(totals);
+			totals->area[key] = band->regions.area[region];
+			totals->perimeter[key] = band->regions.perimeter[region];
+		}
+		release_garden_regions(&band->regions);
 	}
 
-	/* try go down from here */
-	adj_plant = aoc_mapcache_peek_down(garden);
-	if ((adj_plant != -1) && (adj_plant == region)) {
-		aoc_mapcache_step_down(garden);
-		process_region(garden, region, plot_lut, area, perimeter);
-		aoc_mapcache_step_up(garden);
-	} else {
-		*perimeter += 1;
+	/* merge regions that meet across band borders */
+	*keys = malloc(totals->count * sizeof ** keys);
+	assert(*keys != NULL);
+	for (key = 0; key < totals->count; key++) {
+		(*keys)[key] = key;
+	}
+	for (b = 1; b < nr_bands; b++) {
+		int row = bands[b].first_row;
+		for (col = 0; col < grid->width; col++) {
+			size_t plot = (size_t)row * grid->width + col;
+			if (same_plant(grid, plot, row - 1, col) == false)
+				continue;
+			union_labels(*keys, bands[b].base + labels[plot],
+				bands[b - 1].base + labels[plot - grid->width]);
+		}
 	}
 
-	/* try go left from here */
-	adj_plant = aoc_mapcache_peek_left(garden);
-	if ((adj_plant != -1) && (adj_plant == region)) {
-		aoc_mapcache_step_left(garden);
-		process_region(garden, region, plot_lut, area, perimeter);
-		aoc_mapcache_step_right(garden);
-	} else {
-		*perimeter += 1;
+	/* roots come first, so fold every key into its root */
+	for (key = 0; key < totals->count; key++) {
+		size_t root = find_label(*keys, key);
+		if (root == key)
+			continue;
+		totals->area[root] += totals->area[key];
+		totals->perimeter[root] += totals->perimeter[key];
 	}
 
+	free(bands);
+	free(labels);
 	return;
 }
 
 int main(void)
 {
 	struct aoc_mapcache *garden;
-	struct aoc_lut *plot_lut;
-	int total_price = 0;
+	struct garden_grid *grid;
+	struct garden_regions totals;
+	size_t *keys;
+	unsigned long total_price = 0;
+	size_t key;
 
 	garden = aoc_new_mapcache("input");
-	plot_lut = aoc_new_lut(12, sizeof(unsigned long), 0);
 	assert(garden);
-	assert(plot_lut);
-
-	/* pass 1: attach metadata to all plots on the map */
-	aoc_mapcache_reset(garden);
-	for (;;) {
-		unsigned long plot_id;
-		int plant;
-		plant = aoc_mapcache_tile(garden, &plot_id);
-		assert(plant != -1);
-		add_garden_plot(plot_lut, plot_id);
-		if (aoc_mapcache_walk_forward(garden) == -1)
-			break;
-	}
+	grid = new_garden_grid(garden);
+	aoc_free_mapcache(garden);
 
-	/* pass 2: for each unvisited tile we encounter... process the region
-	 * where it belongs */
-	aoc_mapcache_reset(garden);
-	for (;;) {
-		int plant;
-		int area = 0;
-		int perimeter = 0;
-		plant = aoc_mapcache_tile(garden, NULL);
-		process_region(garden, plant, plot_lut, &area, &perimeter);
-		if (perimeter > 0) {
-			assert(area > 0);
-			total_price = total_price + (area * perimeter);
-		}
-		if (aoc_mapcache_walk_forward(garden) == -1)
-			break;
+	survey_garden(grid, &totals, &keys);
+	for (key = 0; key < totals.count; key++) {
+		if (keys[key] != key)
+			continue;
+		total_price += totals.area[key] * totals.perimeter[key];
 	}
-	printf("total price: %d\n", total_price);
+	printf("total price: %lu\n", total_price);
 
-	aoc_free_lut(plot_lut);
-	aoc_free_mapcache(garden);
+	free(keys);
+	release_garden_regions(&totals);
+	free_garden_grid(grid);
         return 0;
 }
-
@@ -2,552 +2,376 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdbool.h>
-#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
 
 #include <aoc/mapcache.h>
-#include <aoc/lut.h>
-#include <aoc/dlist.h>
-#include <aoc/bot.h>
-
-struct garden_region {
-	int plant;
-	int area;
-	struct aoc_dlist_node node; /* next region */
-
-	struct aoc_dlist_node top_edges;
-	struct aoc_dlist_node bottom_edges;
-	struct aoc_dlist_node right_edges;
-	struct aoc_dlist_node left_edges;
-};
-
-struct plot_info {
-	struct garden_region *region;
-};
-
-struct point {
-	int x;
-	int y;
-};
 
-struct edge {
-	struct point start;
-	struct point end;
-	struct aoc_dlist_node node; /* link to region edges */
+/* the garden copied out of the mapcache into a flat row-major array */
+struct garden_grid {
+	char *plants;
+	int width;
+	int height;
+	size_t plot_count;
 };
 
-static struct garden_region *new_garden_region(int plant)
-{
-	struct garden_region *region;
-	region = malloc(sizeof(struct garden_region));
-	assert(region != NULL);
-	region->plant = plant;
-	region->area = 0;
-
-	aoc_dlist_init(&region->top_edges);
-	aoc_dlist_init(&region->bottom_edges);
-	aoc_dlist_init(&region->right_edges);
-	aoc_dlist_init(&region->left_edges);
-	return region;
-}
-
-static void garden_plot_scan_region(struct aoc_mapcache *garden, 
-	struct garden_region *region, struct aoc_lut *plot_lut)
+static struct garden_grid *new_garden_grid(struct aoc_mapcache *garden)
 {
-	int err;
-	unsigned long plot_id;
-	int plant;
-	int adj_plant;
-	struct plot_info plot_info;
-
-	/* stop processing. we have visited this plot before */
-	plant = aoc_mapcache_tile(garden, &plot_id);
-	err = aoc_lut_lookup(plot_lut, &plot_id, sizeof plot_id, &plot_info, sizeof plot_info);
-	if (err == 0) {
-		return;
-	}
-
-	/* are we crossing over to a new region of plants? */
-	if (plant != region->plant) {
-		return;
-	}
-
-	/* add this new area to this region */
-	plot_info.region = region;
-	region->area += 1;
-	
-	/* add this lut again with update information */
-	err = aoc_lut_add(plot_lut, &plot_id, sizeof plot_id,
-			&plot_info, sizeof plot_info);
-	assert(err == 0);
-
-	/* try to go up from here */
-	adj_plant = aoc_mapcache_peek_up(garden);
-	if ((adj_plant != -1) && (adj_plant == region->plant)) {
-		aoc_mapcache_step_up(garden);
-		garden_plot_scan_region(garden, region, plot_lut);
-		aoc_mapcache_step_down(garden);
-	}
-
-	/* try to go right from here */
-	adj_plant = aoc_mapcache_peek_right(garden);
-	if ((adj_plant != -1) && (adj_plant == region->plant)) {
-		aoc_mapcache_step_right(garden);
-		garden_plot_scan_region(garden, region, plot_lut);
-		aoc_mapcache_step_left(garden);
-	}
-
-	/* try to go down from here */
-	adj_plant = aoc_mapcache_peek_down(garden);
-	if ((adj_plant != -1) && (adj_plant == region->plant)) {
-		aoc_mapcache_step_down(garden);
-		garden_plot_scan_region(garden, region, plot_lut);
-		aoc_mapcache_step_up(garden);
-	}
-
-	/* try to go left from here */
-	adj_plant = aoc_mapcache_peek_left(garden);
-	if ((adj_plant != -1) && (adj_plant == region->plant)) {
-		aoc_mapcache_step_left(garden);
-		garden_plot_scan_region(garden, region, plot_lut);
-		aoc_mapcache_step_right(garden);
-	}
-
-	return;
-}
+	struct garden_grid *grid;
+	assert(garden != NULL);
 
-static bool edges_are_the_same(struct edge *edge1, struct edge *edge2)
-{
-	assert(edge1 != NULL);
-	assert(edge2 != NULL);
-	static const size_t size = sizeof(struct point);
-	if ((memcmp(&edge1->start, &edge2->start, size) == 0) &&
-		(memcmp(&edge2->end, &edge2->end, size) == 0)) {
-		return true;
-	}
-	return false;
-}
+	grid = malloc(sizeof * grid);
+	assert(grid != NULL);
+	grid->width = aoc_mapcache_width(garden);
+	grid->height = aoc_mapcache_height(garden);
+	grid->plot_count = (size_t)grid->width * grid->height;
+	grid->plants = malloc(grid->plot_count);
+	assert(grid->plants != NULL);
 
-static bool has_duplicate_edge(struct aoc_dlist_node *edge_list, 
-	struct edge *edge)
-{
-	struct edge *tmp_edge;
-	struct aoc_dlist_node *node;
-	assert(edge_list != NULL);
-	assert(edge != NULL);
-	for (node = edge_list->next; node != edge_list; node = node->next) {
-		tmp_edge = aoc_dlist_container(node, offsetof(struct edge, node));
-		if (edges_are_the_same(edge, tmp_edge) == true)
-			return true;
+	aoc_mapcache_reset(garden);
+	for (;;) {
+		int plant;
+		int row;
+		int col;
+		plant = aoc_mapcache_tile(garden, NULL);
+		assert(plant != -1);
+		aoc_mapcache_coord(garden, &row, &col);
+		grid->plants[(size_t)row * grid->width + col] = (char)plant;
+		if (aoc_mapcache_walk_forward(garden) == -1)
+			break;
 	}
-	return false;
+	return grid;
 }
 
-/* for horizontal checking */
-static bool same_row_edges(struct edge *edge1, struct edge *edge2)
+static void free_garden_grid(struct garden_grid *grid)
 {
-	if (edge1->start.x == edge2->start.x) {
-		assert(edge1->end.x == edge2->end.x);
-		return true;
-	}
-	return false;
+	free(grid->plants);
+	free(grid);
+	return;
 }
 
-/* assumption here is edge2 must come after edge1 */
-static bool adjacent_row_edges(struct edge *edge1, struct edge *edge2)
-{
-	/* adjacent edges should be same rows as well */
-	if (same_row_edges(edge1, edge2) == true) {
-		if (edge1->end.y == edge2->start.y) {
-			return true;
-		}
-	}
-	return false;
-}
+/* totals of every region, indexed by region id */
+struct garden_regions {
+#define GARDEN_REGIONS_SIZE	64
+	size_t *area;
+	size_t *perimeter;
+	size_t *corners; /* a region has as many sides as corners */
+	size_t count;
+	size_t size;
+};
 
-/* combine edge2 to edge1 e.g. edge2 will be made to disappear soon */
-static void combine_row_edges(struct edge *edge1, struct edge *edge2)
+static void init_garden_regions(struct garden_regions *regions)
 {
-	edge1->end.y = edge2->end.y;
+	regions->area = NULL;
+	regions->perimeter = NULL;
+	regions->corners = NULL;
+	regions->count = 0;
+	regions->size = 0;
 	return;
 }
 
-static bool coalesce_horizontal_edge(struct aoc_dlist_node *edge_list,
-	struct edge *edge)
+static void release_garden_regions(struct garden_regions *regions)
 {
-	struct edge *tmp_edge;
-	struct aoc_dlist_node *node;
-	assert(edge_list != NULL);
-	assert(edge != NULL);
-
-	/* coalesce back */
-	for (node = edge_list->next; node != edge_list; node = node->next) {
-		tmp_edge = aoc_dlist_container(node, offsetof(struct edge, node));
-		if (adjacent_row_edges(tmp_edge, edge) == true) {
-			combine_row_edges(tmp_edge, edge);
-			return true;
-		}
-	}
-	return false;
+	free(regions->area);
+	free(regions->perimeter);
+	free(regions->corners);
+	return;
 }
 
-/* for vertical checking */
-static bool same_col_edges(struct edge *edge1, struct edge *edge2)
+static size_t garden_regions_new(struct garden_regions *regions)
 {
-	if (edge1->start.y == edge2->start.y) {
-		assert(edge1->end.y == edge2->end.y);
-		return true;
+	if (regions->count == regions->size) {
+		regions->size = regions->size ? regions->size * 2 :
+			GARDEN_REGIONS_SIZE;
+		regions->area = realloc(regions->area,
+			regions->size * sizeof * regions->area);
+		assert(regions->area != NULL);
+		regions->perimeter = realloc(regions->perimeter,
+			regions->size * sizeof * regions->perimeter);
+		assert(regions->perimeter != NULL);
+		regions->corners = realloc(regions->corners,
+			regions->size * sizeof * regions->corners);
+		assert(regions->corners != NULL);
 	}
-	return false;
+	regions->area[regions->count] = 0;
+	regions->perimeter[regions->count] = 0;
+	regions->corners[regions->count] = 0;
+	regions->count += 1;
+	return regions->count - 1;
 }
 
-/* assumption here is edge2 must come after edge1 */
-static bool adjacent_col_edges(struct edge *edge1, struct edge *edge2)
+/* labels double as the union-find forest: a plot points at a plot of its
+ * region that comes earlier in scan order, a root points at itself. */
+static size_t find_label(size_t *labels, size_t plot)
 {
-	/* adjacent edges should be same column as well */
-	if (same_col_edges(edge1, edge2) == true) {
-		if (edge1->end.x == edge2->start.x) {
-			return true;
-		}
+	while (labels[plot] != plot) {
+		labels[plot] = labels[labels[plot]];
+		plot = labels[plot];
 	}
-	return false;
+	return plot;
 }
 
-/* combine edge2 to edge1 e.g. edge2 will be made to disappear soon */
-static void combine_col_edges(struct edge *edge1, struct edge *edge2)
+/* the root that comes first in scan order wins, so labels only ever
+ * point backwards */
+static void union_labels(size_t *labels, size_t plot1, size_t plot2)
 {
-	edge1->end.x = edge2->end.x;
+	plot1 = find_label(labels, plot1);
+	plot2 = find_label(labels, plot2);
+	if (plot1 < plot2)
+		labels[plot2] = plot1;
+	else if (plot2 < plot1)
+		labels[plot1] = plot2;
 	return;
 }
 
-static bool coalesce_vertical_edge(struct aoc_dlist_node *edge_list,
-	struct edge *edge)
+static bool same_plant(struct garden_grid *grid, size_t plot, int row,
+	int col)
 {
-	struct edge *tmp_edge;
-	struct aoc_dlist_node *node;
-	assert(edge_list != NULL);
-	assert(edge != NULL);
-
-	/* coalesce back */
-	for (node = edge_list->next; node != edge_list; node = node->next) {
-		tmp_edge = aoc_dlist_container(node, offsetof(struct edge, node));
-		if (adjacent_col_edges(tmp_edge, edge) == true) {
-			combine_col_edges(tmp_edge, edge);
-			return true;
-		}
-	}
-	return false;
+	if ((row < 0) || (row >= grid->height) ||
+		(col < 0) || (col >= grid->width))
+		return false;
+	return grid->plants[(size_t)row * grid->width + col] ==
+		grid->plants[plot];
 }
 
-static struct edge *new_edge(struct edge *edge)
+/* the corner of a plot at one of its four 2x2 windows. h and v are its
+ * horizontal and vertical neighbours in the window, diag the one across.
+ * it is a convex corner if neither neighbour is in its region and a
+ * concave one if both are but the plot across is not. plants tell as much
+ * as region labels here: a neighbour with the same plant is in the same
+ * region, and so is the plot across when both neighbours are. */
+static int plot_corner(struct garden_grid *grid, size_t plot, int row,
+	int col, int drow, int dcol)
 {
-	struct edge *tmp;
-	if ((tmp = malloc(sizeof * tmp)) != NULL) {
-		*tmp = *edge;
-	}
-	return tmp;
+	bool h = same_plant(grid, plot, row, col + dcol);
+	bool v = same_plant(grid, plot, row + drow, col);
+	bool diag = same_plant(grid, plot, row + drow, col + dcol);
+	if ((h == false) && (v == false))
+		return 1;
+	if ((h == true) && (v == true) && (diag == false))
+		return 1;
+	return 0;
 }
 
-static void region_add_horizontal_edge(struct aoc_mapcache *garden,
-	struct aoc_dlist_node *edge_list, struct edge *edge)
+static int plot_corners(struct garden_grid *grid, size_t plot, int row,
+	int col)
 {
-	assert(garden != NULL);
-	assert(edge_list != NULL);
-	assert(edge != NULL);
-
-	/* first find duplicate. some edges are shared between two plots */
-	if (has_duplicate_edge(edge_list, edge) == true) {
-		return;
-	}
-
-	/* then try to coalesce. adjacent edges grow, otherwise, add new 
-	 * unique edge */
-	if (coalesce_horizontal_edge(edge_list, edge) == false) {
-		struct edge *tmp = new_edge(edge);
-		assert(tmp != NULL);
-		aoc_dlist_prepend(edge_list, &tmp->node);
-	}
-	return;
+	return plot_corner(grid, plot, row, col, -1, -1) +
+		plot_corner(grid, plot, row, col, -1, 1) +
+		plot_corner(grid, plot, row, col, 1, -1) +
+		plot_corner(grid, plot, row, col, 1, 1);
 }
 
-static void region_add_vertical_edge(struct aoc_mapcache *garden,
-	struct aoc_dlist_node *edge_list, struct edge *edge)
+/* pass 1 of the scanline labeling of the rows [first_row, last_row):
+ * every plot joins the region of its left and upper neighbours when they
+ * grow the same plant, linking the two when both do. plots above the
+ * first row are left to the merge along band borders. */
+static void label_garden(struct garden_grid *grid, size_t *labels,
+	int first_row, int last_row)
 {
-	assert(garden != NULL);
-	assert(edge_list != NULL);
-	assert(edge != NULL);
-
-	/* first find duplicate. some edges are shared between two plots */
-	if (has_duplicate_edge(edge_list, edge) == true) {
-		return;
-	}
-
-	/* then try to coalesce. adjacent edges grow, otherwise, add new 
-	 * unique edge */
-	if (coalesce_vertical_edge(edge_list, edge) == false) {
-		struct edge *tmp = new_edge(edge);
-		assert(tmp != NULL);
-		aoc_dlist_prepend(edge_list, &tmp->node);
+	int row;
+	int col;
+
+	for (row = first_row; row < last_row; row++) {
+		for (col = 0; col < grid->width; col++) {
+			size_t plot = (size_t)row * grid->width + col;
+			bool left = same_plant(grid, plot, row, col - 1);
+			bool up = (row > first_row) &&
+				same_plant(grid, plot, row - 1, col);
+			labels[plot] = plot;
+			if (left == true)
+				labels[plot] = labels[plot - 1];
+			if (up == true) {
+				if (left == true)
+					union_labels(labels, plot - 1,
+						plot - grid->width);
+				else
+					labels[plot] = labels[plot - grid->width];
+			}
+		}
 	}
-
 	return;
 }
 
-static bool edge_is_boundary(struct aoc_mapcache *garden, 
-	enum aoc_direction dir, struct garden_region *region, int plant)
+/* pass 2: give roots a region id in scan order and rewrite every label
+ * into the region id of its root. all labels point backwards, so the one
+ * a plot points at has been rewritten already. area, perimeter and corners are
+ * added up on the way. */
+static void resolve_regions(struct garden_grid *grid, size_t *labels,
+	int first_row, int last_row, struct garden_regions *regions)
 {
-	switch (dir) {
-	case aoc_direction_up:
-		plant = aoc_mapcache_peek_up(garden);
-		break;
-	case aoc_direction_right:
-		plant = aoc_mapcache_peek_right(garden);
-		break;
-	case aoc_direction_down:
-		plant = aoc_mapcache_peek_down(garden);
-		break;
-	case aoc_direction_left:
-		plant = aoc_mapcache_peek_left(garden);
-		break;
-	default:
-		assert(false);
+	int row;
+	int col;
+	for (row = first_row; row < last_row; row++) {
+		for (col = 0; col < grid->width; col++) {
+			size_t plot = (size_t)row * grid->width + col;
+			size_t region;
+			int fences = 0;
+
+			if (labels[plot] == plot)
+				region = garden_regions_new(regions);
+			else
+				region = labels[labels[plot]];
+			labels[plot] = region;
+
+			fences += (same_plant(grid, plot, row - 1, col) == false);
+			fences += (same_plant(grid, plot, row + 1, col) == false);
+			fences += (same_plant(grid, plot, row, col - 1) == false);
+			fences += (same_plant(grid, plot, row, col + 1) == false);
+			regions->area[region] += 1;
+			regions->perimeter[region] += fences;
+			regions->corners[region] += plot_corners(grid, plot,
+				row, col);
+		}
 	}
-	return plant != region->plant;
-}
-
-static void init_horizontal_edge(struct edge *edge, int x, int y)
-{
-	edge->start.x = x;
-	edge->start.y = y;
-	edge->end.x = x;
-	edge->end.y = y + 1;
 	return;
 }
 
-static void init_vertical_edge(struct edge *edge, int x, int y)
+/* big gardens are cut into bands of whole rows, one per worker, labeled
+ * concurrently. region ids and the sums gathered for them are local to a
+ * band. regions are then merged across band borders through a union-find
+ * over all band regions, band b's region i having key base + i. */
+struct garden_band {
+#define GARDEN_BAND_ROWS	64
+	pthread_t thread;
+	struct garden_grid *grid;
+	size_t *labels;
+	int first_row;
+	int last_row;
+	struct garden_regions regions;
+	size_t base;
+};
+
+static void *garden_band_run(void *param)
 {
-	edge->start.x = x;
-	edge->start.y = y;
-	edge->end.x = x + 1;
-	edge->end.y = y;
-	return;
+	struct garden_band *band = param;
+	label_garden(band->grid, band->labels, band->first_row,
+		band->last_row);
+	resolve_regions(band->grid, band->labels, band->first_row,
+		band->last_row, &band->regions);
+	return NULL;
 }
 
-static void get_edge_coord(struct aoc_mapcache *garden, struct edge *edge,
-	enum aoc_direction dir)
+static int worker_count(void)
 {
-	int x;
-	int y;
-	assert(garden != NULL);
-	assert(edge != NULL);
-
-	aoc_mapcache_coord(garden, &x, &y);
-	switch(dir) {
-	case aoc_direction_up:
-		init_horizontal_edge(edge, x, y);
-		break;
-	case aoc_direction_right:
-		init_vertical_edge(edge, x, y+1);
-		break;
-	case aoc_direction_down:
-		init_horizontal_edge(edge, x+1, y);
-		break;
-	case aoc_direction_left:
-		init_vertical_edge(edge, x, y);
-		break;
-	default: 
-		assert(0);
-	}
-	return;
+	long count;
+	count = sysconf(_SC_NPROCESSORS_ONLN);
+	if (count < 1)
+		count = 1;
+	if (count > 64)
+		count = 64;
+	return (int)count;
 }
 
-static void garden_plot_edges(struct aoc_mapcache *garden, 
-	struct aoc_lut *plot_lut)
+/* label the garden and sum up every region into totals. afterwards a
+ * region's totals are found under the key that is the root of its keys. */
+static void survey_garden(struct garden_grid *grid,
+	struct garden_regions *totals, size_t **keys)
 {
-	int err;
-	int plant;
-	unsigned long plot_id;
-	struct plot_info plot_info;
-	struct garden_region *region;
-	int x;
-	int y;
-
-	assert(garden != NULL);
-	assert(plot_lut != NULL);
-
-	/* get plot_info of current tile */
-	plant = aoc_mapcache_tile(garden, &plot_id);
-	err = aoc_lut_lookup(plot_lut, &plot_id, sizeof plot_id, &plot_info, sizeof plot_info);
-	assert(err == 0);
-	assert(plot_info.region != NULL);
-
-	/* we now have a reference to the region where this tile belongs */
-	assert(plot_info.region->plant == plant);
-	region = plot_info.region;
-
-	aoc_mapcache_coord(garden, &x, &y);
-	if (edge_is_boundary(garden, aoc_direction_up, region, plant) == true) {
-		struct edge top_edge;
-		get_edge_coord(garden, &top_edge, aoc_direction_up);
-		region_add_horizontal_edge(garden, &region->top_edges, &top_edge);
-	}
-
-	if (edge_is_boundary(garden, aoc_direction_right, region, plant) == true) {
-		struct edge right_edge;
-		get_edge_coord(garden, &right_edge, aoc_direction_right);
-		region_add_vertical_edge(garden, &region->right_edges, &right_edge);
-	}
-
-	if (edge_is_boundary(garden, aoc_direction_down, region, plant) == true) {
-		struct edge bottom_edge;
-		get_edge_coord(garden, &bottom_edge, aoc_direction_down);
-		region_add_horizontal_edge(garden, &region->bottom_edges, &bottom_edge);
+	struct garden_band *bands;
+	size_t *labels;
+	int nr_bands;
+	int b;
+	int col;
+	size_t key;
+
+	/* bands thinner than GARDEN_BAND_ROWS aren't worth a thread */
+	nr_bands = worker_count();
+	if (nr_bands > grid->height / GARDEN_BAND_ROWS)
+		nr_bands = grid->height / GARDEN_BAND_ROWS;
+	if (nr_bands < 1)
+		nr_bands = 1;
+
+	labels = malloc(grid->plot_count * sizeof * labels);
+	assert(labels != NULL);
+	bands = malloc(nr_bands * sizeof * bands);
+	assert(bands != NULL);
+	for (b = 0; b < nr_bands; b++) {
+		struct garden_band *band = &bands[b];
+		band->grid = grid;
+		band->labels = labels;
+		band->first_row = (long)grid->height * b / nr_bands;
+		band->last_row = (long)grid->height * (b + 1) / nr_bands;
+		init_garden_regions(&band->regions);
+		if (pthread_create(&band->thread, NULL, garden_band_run,
+			band) != 0) {
+			fprintf(stderr, "cannot create garden worker\n");
+			exit(-1);
+		}
 	}
 
-	if (edge_is_boundary(garden, aoc_direction_left, region, plant) == true) {
-		struct edge left_edge;
-		get_edge_coord(garden, &left_edge, aoc_direction_left);
-		region_add_vertical_edge(garden, &region->left_edges, &left_edge);
+	/* gather the partial sums of all bands in band order */
+	init_garden_regions(totals);
+	for (b = 0; b < nr_bands; b++) {
+		struct garden_band *band = &bands[b];
+		size_t region;
+		pthread_join(band->thread, NULL);
+		band->base = totals->count;
+		for (region = 0; region < band->regions.count; region++) {
+			key = garden_regions_new(totals);
+			totals->area[key] = band->regions.area[region];
+			totals->perimeter[key] = band->regions.perimeter[region];
+			totals->corners[key] = band->regions.corners[region];
+		}
+		release_garden_regions(&band->regions);
 	}
 
-	return;
-}
-
-#if 0
-static void print_edges(struct aoc_dlist_node *edge_list)
-{
-	struct aoc_dlist_node *node;
-	struct edge *edge;
-	assert(edge_list != NULL);
-	for (node = edge_list->next; node != edge_list; node = node->next) {
-		edge = aoc_dlist_container(node, offsetof(struct edge, node));
-		printf("(%d:%d) -> (%d,%d)\n",
-			edge->start.x, edge->start.y, edge->end.x, edge->end.y);
+	/* merge regions that meet across band borders */
+	*keys = malloc(totals->count * sizeof ** keys);
+	assert(*keys != NULL);
+	for (key = 0; key < totals->count; key++) {
+		(*keys)[key] = key;
 	}
-	return;
-}
-#endif
-
-static int count_nodes(struct aoc_dlist_node *edge_list)
-{
-	struct aoc_dlist_node *node;
-	int count = 0;
-	assert(edge_list != NULL);
-	for (node = edge_list->next; node != edge_list; node = node->next) {
-		count += 1;
+	for (b = 1; b < nr_bands; b++) {
+		int row = bands[b].first_row;
+		for (col = 0; col < grid->width; col++) {
+			size_t plot = (size_t)row * grid->width + col;
+			if (same_plant(grid, plot, row - 1, col) == false)
+				continue;
+			union_labels(*keys, bands[b].base + labels[plot],
+				bands[b - 1].base + labels[plot - grid->width]);
+		}
 	}
-	return count;
-}
-
-static int region_get_price(struct garden_region *region)
-{
-	int v_edges;
-	int h_edges;
-	assert(region != NULL);
-
-	/* count unique horizontal edges */
-	h_edges = count_nodes(&region->top_edges);
-	h_edges += count_nodes(&region->bottom_edges);
-	
-	/* count unique vertical edges */
-	v_edges = count_nodes(&region->left_edges);
-	v_edges += count_nodes(&region->right_edges);
-
-	return region->area * (v_edges + h_edges);
-}
 
-static void region_free_edge_list(struct aoc_dlist_node *edge_list)
-{
-	struct aoc_dlist_node *node;
-	struct edge *edge;
-	assert(edge_list != NULL);
-	for (node = edge_list->next; node != edge_list; ) {
-		edge = aoc_dlist_container(node, offsetof(struct edge, node));
-		node = node->next;
-		aoc_dlist_remove(&edge->node);
-		free(edge);
+	/* roots come first, so fold every key into its root */
+	for (key = 0; key < totals->count; key++) {
+		size_t root = find_label(*keys, key);
+		if (root == key)
+			continue;
+		totals->area[root] += totals->area[key];
+		totals->perimeter[root] += totals->perimeter[key];
+		totals->corners[root] += totals->corners[key];
 	}
 
-	return;
-}
-
-static void region_free_edges(struct garden_region *region)
-{
-	assert(region != NULL);
-	region_free_edge_list(&region->top_edges);
-	region_free_edge_list(&region->right_edges);
-	region_free_edge_list(&region->bottom_edges);
-	region_free_edge_list(&region->left_edges);
-	return;
-}
-
-static void free_region(struct garden_region *region)
-{
-	assert(region);
-	region_free_edges(region);
-	free(region);
+	free(bands);
+	free(labels);
 	return;
 }
 
 int main(void)
 {
 	struct aoc_mapcache *garden;
-	struct aoc_lut *plot_lut;
-	struct aoc_dlist_node regions;
-	int total_price = 0;
+	struct garden_grid *grid;
+	struct garden_regions totals;
+	size_t *keys;
+	unsigned long total_price = 0;
+	size_t key;
 
 	garden = aoc_new_mapcache("input");
-	plot_lut = aoc_new_lut(12, sizeof(unsigned long), sizeof(struct plot_info));
 	assert(garden);
-	assert(plot_lut);
-
-	/* pass 1: for each unvisited tile we encounter... process the region
-	 * where it belongs */
-	aoc_mapcache_reset(garden);
-	aoc_dlist_init(&regions);
-	for (;;) {
-		int err;
-		unsigned long plot_id;
-		int plant;
-		struct plot_info plot_info;
-
-		plant = aoc_mapcache_tile(garden, &plot_id);
-		err = aoc_lut_lookup(plot_lut, &plot_id, sizeof plot_id,
-				&plot_info, sizeof plot_info);
-		if (err == -1) {
-			struct garden_region *region;
-			region = new_garden_region(plant);
-			assert(region != NULL);
-			aoc_dlist_prepend(&regions, &region->node);
-			garden_plot_scan_region(garden, region, plot_lut);
-			assert(aoc_lut_lookup(plot_lut, &plot_id, sizeof plot_id,
-				&plot_info, sizeof plot_info) == 0);
-		}
-		assert(plot_info.region != NULL);
-		if (aoc_mapcache_walk_forward(garden) == -1)
-			break;
-	}
-
-	/* pass 2: for each tile, get its boundaries */
-	aoc_mapcache_reset(garden);
-	for (;;) {
-		garden_plot_edges(garden, plot_lut);
-		if (aoc_mapcache_walk_forward(garden) == -1)
-			break;
-	}
+	grid = new_garden_grid(garden);
+	aoc_free_mapcache(garden);
 
-	struct garden_region *tmp;
-	struct aoc_dlist_node *node;
-	for (node = regions.next; node != &regions; ) {
-		tmp = aoc_dlist_container(node, offsetof(struct garden_region, node));
-		total_price += region_get_price(tmp);
-		node = node->next;
-		free_region(tmp);
+	survey_garden(grid, &totals, &keys);
+	for (key = 0; key < totals.count; key++) {
+		if (keys[key] != key)
+			continue;
+		total_price += totals.area[key] * totals.corners[key];
 	}
+	printf("total price: %lu\n", total_price);
 
-	printf("total price: %d\n", total_price);
-
-	aoc_free_lut(plot_lut);
-	aoc_free_mapcache(garden);
+	free(keys);
+	release_garden_regions(&totals);
+	free_garden_grid(grid);
         return 0;
 }
-
@@ -3,125 +3,216 @@
 #include <stdlib.h>
 #include <stddef.h>
 #include <stdbool.h>
+#include <string.h>
+#include <limits.h>
 
 #include <aoc/die.h>
-#include <aoc/lncache.h>
-#include <aoc/dlist.h>
 
-struct button_config {
-	long long x;
-	long long y;
-	long long cost;
+#define BUTTON_A_COST	3
+#define BUTTON_B_COST	1
+#define PRIZE_OFFSET	10000000000000LL
+
+/* machines are scanned into a batch of columns, one column per number of
+ * the machine description, and solved a batch at a time so memory use
+ * doesn't grow with the input. */
+struct machine_batch {
+#define MACHINE_BATCH	4096
+#define MACHINE_FIELDS	6
+	long long ax[MACHINE_BATCH];
+	long long ay[MACHINE_BATCH];
+	long long bx[MACHINE_BATCH];
+	long long by[MACHINE_BATCH];
+	long long px[MACHINE_BATCH];
+	long long py[MACHINE_BATCH];
+	size_t count;
 };
 
-struct prize {
-	long long x;
-	long long y;
+/* the input grammar is fixed: every machine is the same three lines with
+ * six numbers in the same order and nothing else numeric in between. the
+ * scanner only needs to pick up the digits. */
+struct machine_scanner {
+	long long value;
+	bool in_number;
+	int field; /* which of the six numbers is being read */
 };
 
-struct move_code {
-	struct button_config a;
-	struct button_config b;
-	struct prize prize;
-	struct aoc_dlist_node node; /* link to next button_and_prize */
-};
-
-static void extract_to_buffer(struct aoc_lncache *cache,
-	char *buffer, size_t buf_len, int idx)
+static void machine_batch_store(struct machine_batch *batch, int field,
+	long long value)
 {
-	struct aoc_line *line;
-	int ret;
-	size_t line_len;
-	assert(cache != NULL);
-	assert(buffer != NULL);
-	assert(buf_len > 0);
-	assert(idx >= 0);
-	
-	ret = aoc_lncache_getline(cache, &line, idx);
-	if (ret == -1) {
+	size_t i = batch->count;
+	switch (field) {
+	case 0:
+		batch->ax[i] = value;
+		break;
+	case 1:
+		batch->ay[i] = value;
+		break;
+	case 2:
+		batch->bx[i] = value;
+		break;
+	case 3:
+		batch->by[i] = value;
+		break;
+	case 4:
+		batch->px[i] = value + PRIZE_OFFSET;
+		break;
+	case 5:
+		batch->py[i] = value + PRIZE_OFFSET;
+		batch->count += 1;
+		break;
+	default:
 		assert(0);
 	}
-	line_len = aoc_line_strlen(line);
-	assert(line_len < buf_len);
-	aoc_line_get(line, buffer, buf_len);
 	return;
 }
 
-static void button_extract(char *line, struct button_config *config, int cost)
+typedef __int128 wide_t;
+
+/* a * x + b * y = gcd(a, b) for a, b >= 0 */
+static wide_t extended_gcd(wide_t a, wide_t b, wide_t *x, wide_t *y)
 {
-	char button;
-
-	long long x;
-	long long y;
-	assert(line != NULL);
-	assert(config != NULL);
-	sscanf(line, "Button %c: X+%lld, Y+%lld", &button, &x, &y);
-	config->x = x;
-	config->y = y;
-	config->cost = cost;
-	/*printf("Button %c -> X: %d, Y:%d\n", button, *x, *y);*/
-	return;
+	wide_t x0 = 1;
+	wide_t y0 = 0;
+	wide_t x1 = 0;
+	wide_t y1 = 1;
+	while (b != 0) {
+		wide_t q = a / b;
+		wide_t tmp;
+		tmp = a - q * b;
+		a = b;
+		b = tmp;
+		tmp = x0 - q * x1;
+		x0 = x1;
+		x1 = tmp;
+		tmp = y0 - q * y1;
+		y0 = y1;
+		y1 = tmp;
+	}
+	*x = x0;
+	*y = y0;
+	return a;
 }
 
-static void prize_extract(char *line, struct prize *prize)
+/* rounding towards minus infinity, b > 0 */
+static wide_t floor_div(wide_t a, wide_t b)
 {
-	long long x;
-	long long y;
-	static const long long offset = 10000000000000;
-	assert(line != NULL);
-	assert(prize != NULL);
-	sscanf(line, "Prize: X=%lld, Y=%lld", &x, &y);
-	prize->x = x + offset;
-	prize->y = y + offset;
-	/*printf("Prize->  X:%d, Y:%d\n", *x, *y);*/
-	return;
+	wide_t q = a / b;
+	if ((a % b != 0) && (a < 0))
+		q -= 1;
+	return q;
 }
 
-static void append_new_cheat_code(struct aoc_dlist_node *cheat_code_list,
-	char *button_a_line, char *button_b_line, char *prize_line)
+/* cheapest m, n >= 0 with m * a + n * b = p, or -1 if there are none.
+ * extended euclid gives one solution, all others are
+ * 	m + k * b / g, n - k * a / g
+ * and the cost changes linearly in k, so the cheapest one is at whichever
+ * end of the range of k that keeps both counts non-negative. */
+static long long cheapest_presses(wide_t a, wide_t b, wide_t p)
 {
-	struct move_code *move_code;
-
-	assert(cheat_code_list != NULL);
-	assert(button_a_line != NULL);
-	assert(button_b_line != NULL);
-	assert(prize_line != NULL);
-
-	move_code = malloc(sizeof * move_code);
-	assert(move_code != NULL);
-	
-	button_extract(button_a_line, &move_code->a, 3);
-	button_extract(button_b_line, &move_code->b, 1);
-	prize_extract(prize_line, &move_code->prize);
-
-	aoc_dlist_append(cheat_code_list->prev, &move_code->node);
-	
-	return;
+	wide_t g;
+	wide_t m;
+	wide_t n;
+	wide_t k;
+	wide_t slope;
+	assert(a >= 0 && b >= 0 && p >= 0);
+
+	if (a == 0 && b == 0)
+		return p == 0 ? 0 : -1;
+	if (b == 0)
+		return p % a != 0 ? -1 : (long long)(p / a * BUTTON_A_COST);
+	if (a == 0)
+		return p % b != 0 ? -1 : (long long)(p / b * BUTTON_B_COST);
+
+	g = extended_gcd(a, b, &m, &n);
+	if (p % g != 0)
+		return -1;
+	m *= p / g;
+	n *= p / g;
+	a /= g;
+	b /= g;
+
+	slope = BUTTON_A_COST * b - BUTTON_B_COST * a;
+	if (slope >= 0)
+		k = -floor_div(m, b); /* fewest a presses, m >= 0 */
+	else
+		k = floor_div(n, a); /* fewest b presses, n >= 0 */
+	m += k * b;
+	n -= k * a;
+	if (m < 0 || n < 0)
+		return -1;
+	return (long long)(m * BUTTON_A_COST + n * BUTTON_B_COST);
 }
 
-static void create_cheat_code_list (
-	struct aoc_lncache *button_config_file,
-	struct aoc_dlist_node *move_codes)
+/* the buttons move the claw along the same line, so there is no unique
+ * solution to pick. the prize has to be on that line too, and then only
+ * one equation is left, taken along an axis the line isn't perpendicular
+ * to. */
+static long long solve_degenerate_machine(struct machine_batch *batch,
+	size_t i)
 {
-	int line_count;
-	int i;
-	assert(button_config_file != NULL);
-	assert(move_codes);
-
-	/* cheat codes are in groups of three lines */
-	line_count = aoc_lncache_line_count(button_config_file);
-	assert(line_count > 0);
-	for (i = 0; i < line_count; i += 3) {
-		char line1[128]; /* button A */
-		char line2[128]; /* button B */
-		char line3[128]; /* prize */
-
-		extract_to_buffer(button_config_file, line1, sizeof line1, i);
-		extract_to_buffer(button_config_file, line2, sizeof line2, i+1);
-		extract_to_buffer(button_config_file, line3, sizeof line3, i+2);
-		append_new_cheat_code(move_codes, line1, line2, line3);
+	wide_t dx = batch->ax[i];
+	wide_t dy = batch->ay[i];
+	if (dx == 0 && dy == 0) {
+		dx = batch->bx[i];
+		dy = batch->by[i];
 	}
-	
+	if (dx == 0 && dy == 0)
+		return (batch->px[i] == 0 && batch->py[i] == 0) ? 0 : -1;
+	if (dx * batch->py[i] != dy * batch->px[i])
+		return -1;
+	if (dx != 0)
+		return cheapest_presses(batch->ax[i], batch->bx[i],
+			batch->px[i]);
+	return cheapest_presses(batch->ay[i], batch->by[i], batch->py[i]);
+}
+
+/* a machine whose products may not fit 64 bits, solved by cramer's rule
+ * (see below) in 128 bits */
+static long long solve_wide_machine(struct machine_batch *batch, size_t i)
+{
+	wide_t det;
+	wide_t num_m;
+	wide_t num_n;
+	wide_t m;
+	wide_t n;
+
+	det = (wide_t)batch->ax[i] * batch->by[i] -
+		(wide_t)batch->ay[i] * batch->bx[i];
+	if (det == 0)
+		return solve_degenerate_machine(batch, i);
+	num_m = (wide_t)batch->px[i] * batch->by[i] -
+		(wide_t)batch->py[i] * batch->bx[i];
+	num_n = (wide_t)batch->ax[i] * batch->py[i] -
+		(wide_t)batch->ay[i] * batch->px[i];
+	if ((num_m % det != 0) || (num_n % det != 0))
+		return -1;
+	m = num_m / det;
+	n = num_n / det;
+	if (m < 0 || n < 0)
+		return -1;
+	return (long long)(m * BUTTON_A_COST + n * BUTTON_B_COST);
+}
+
+/* the vector type the batch is solved in */
+typedef long long claw_vec __attribute__((vector_size(32)));
+typedef double claw_real __attribute__((vector_size(32)));
+#define CLAW_LANES	(sizeof(claw_vec) / sizeof(long long))
+
+/* lanes whose button times prize products stay below this are solved in
+ * 64 bit lanes. the press counts of a won machine are at most the prize,
+ * so costs stay far from overflowing too. */
+#define CLAW_PRODUCT_MAX	0x1p60
+
+static inline void claw_vec_load(claw_vec *v, const long long *column)
+{
+	memcpy(v, column, sizeof * v);
+	return;
+}
+
+static inline void claw_vec_max(claw_vec *a, const claw_vec *b)
+{
+	claw_vec greater = *b > *a;
+	*a = (*a & ~greater) | (*b & greater);
 	return;
 }
 
@@ -167,26 +258,6 @@ static void create_cheat_code_list (
  * 	-----------------------------
  * 	    a.X * b.Y - a.Y * b.X
  */
-static int compute_m(long long finalx, long long finaly, long long ax, long long ay,
-	long long bx, long long by, long long *m)
-{
-	long long numerator;
-	long long denominator;
-
-	numerator = (finalx * by) - (finaly * bx);
-	denominator = (ax * by) - (ay * bx);
-
-	if ((numerator % denominator) != 0)
-		return -1;
-
-	if ((numerator / denominator) < 0)
-		return -1;
-
-	*m = numerator / denominator;
-
-	return 0;
-}
-
 /* ok now lets try computing for n. again we have the ff equations: 
  * 	final.X = m * a.X + n * b.X
  * 	final.Y = m * a.Y + n * b.Y
@@ -204,93 +275,158 @@ static int compute_m(long long finalx, long long finaly, long long ax, long long
  * 	-----------------
  * 	       b.X
  */
-static int compute_n(long long finalx, long long m, long long ax,
-	long long bx, long long *n)
-{
-	long long numerator;
-	long long denominator;
-
-	numerator = finalx - (m * ax);
-	denominator = bx;
-
-	if ((numerator % denominator) != 0)
-		return -1;
-
-	if ((numerator / denominator) < 0)
-		return -1;
-
-	*n = numerator / denominator;
-
-	return 0;
-}
-
-static long long compute_smallest_token(struct move_code *move_code)
+/* the same by cramer's rule, n being
+ * 	a.X * final.Y - a.Y * final.X = n
+ * 	-----------------------------
+ * 	    a.X * b.Y - a.Y * b.X
+ *
+ * a machine can be won if the determinant is non-zero and divides both
+ * numerators, and both press counts come out non-negative. all of that is
+ * worked out for CLAW_LANES machines at once, lanes that can't be won
+ * being masked out of the cost. lanes with a zero determinant, or with
+ * numbers large enough for the products to overflow, are left to the
+ * scalar solvers. the size check is done in doubles, which can't
+ * overflow and are exact enough for a bound with that much margin. */
+static long long solve_machine_batch(struct machine_batch *batch)
 {
-	long long m;
-	long long n;
-
-	if (compute_m(move_code->prize.x, move_code->prize.y, move_code->a.x, move_code->a.y, move_code->b.x, move_code->b.y, &m) == -1) {
-		return -1;
+	claw_vec total = { 0 };
+	long long tokens = 0;
+	size_t lane;
+	size_t i;
+
+	/* pad the batch to whole vectors with machines nobody can win */
+	for (i = batch->count; i % CLAW_LANES != 0; i++) {
+		batch->ax[i] = batch->ay[i] = batch->bx[i] = batch->by[i] = 0;
+		batch->px[i] = batch->py[i] = 1;
 	}
 
-	if (compute_n(move_code->prize.x, m, move_code->a.x, move_code->b.x, &n) == -1) {
-		return -1;
+	for (i = 0; i < batch->count; i += CLAW_LANES) {
+		claw_vec ax;
+		claw_vec ay;
+		claw_vec bx;
+		claw_vec by;
+		claw_vec px;
+		claw_vec py;
+		claw_vec det;
+		claw_vec button_max;
+		claw_vec number_max;
+		claw_vec wide;
+		claw_vec degenerate;
+		claw_vec scalar;
+		claw_vec num_m;
+		claw_vec num_n;
+		claw_vec m;
+		claw_vec n;
+		claw_vec won;
+
+		claw_vec_load(&ax, &batch->ax[i]);
+		claw_vec_load(&ay, &batch->ay[i]);
+		claw_vec_load(&bx, &batch->bx[i]);
+		claw_vec_load(&by, &batch->by[i]);
+		claw_vec_load(&px, &batch->px[i]);
+		claw_vec_load(&py, &batch->py[i]);
+
+		button_max = ax;
+		claw_vec_max(&button_max, &ay);
+		claw_vec_max(&button_max, &bx);
+		claw_vec_max(&button_max, &by);
+		number_max = button_max;
+		claw_vec_max(&number_max, &px);
+		claw_vec_max(&number_max, &py);
+		wide = __builtin_convertvector(button_max, claw_real) *
+			__builtin_convertvector(number_max, claw_real) >=
+			CLAW_PRODUCT_MAX;
+
+		det = ax * by - ay * bx;
+		num_m = px * by - py * bx;
+		num_n = ax * py - ay * px;
+
+		/* scalar lanes are all ones. divide them by 1 instead */
+		degenerate = det == 0;
+		scalar = degenerate | wide;
+		det = (det & ~scalar) | (scalar & 1);
+
+		m = num_m / det;
+		n = num_n / det;
+		won = ~scalar & (m * det == num_m) & (n * det == num_n) &
+			(m >= 0) & (n >= 0);
+		total += (m * BUTTON_A_COST + n * BUTTON_B_COST) & won;
+
+		for (lane = 0; lane < CLAW_LANES; lane++) {
+			long long cost;
+			if (scalar[lane] == 0)
+				continue;
+			cost = solve_wide_machine(batch, i + lane);
+			if (cost != -1)
+				tokens += cost;
+		}
 	}
 
-	return (move_code->a.cost * m) + (move_code->b.cost * n);
+	for (i = 0; i < CLAW_LANES; i++) {
+		tokens += total[i];
+	}
+	batch->count = 0;
+	return tokens;
 }
 
-static long long get_minimum_token(struct aoc_dlist_node *move_codes)
+static long long get_minimum_token(FILE *input)
 {
-	struct aoc_dlist_node *node;
+	struct machine_batch *batch;
+	struct machine_scanner scanner = { 0, false, 0 };
 	long long minimium_token = 0;
-	assert(move_codes != NULL);
-	for (node = move_codes->next ; node != move_codes; node = node->next) {
-		struct move_code *move_code;
-		long long smallest_token;
-		move_code = aoc_dlist_container(node, offsetof(struct move_code, node));
-		smallest_token = compute_smallest_token(move_code);
-		if (smallest_token != -1) {
-			minimium_token += smallest_token;
+	char chunk[4096];
+	size_t len;
+	size_t i;
+
+	batch = malloc(sizeof * batch);
+	assert(batch != NULL);
+	batch->count = 0;
+	while ((len = fread(chunk, 1, sizeof chunk, input)) > 0) {
+		for (i = 0; i < len; i++) {
+			int ch = chunk[i];
+			if (ch >= '0' && ch <= '9') {
+				if (scanner.value > (LLONG_MAX - PRIZE_OFFSET) / 10)
+					aoc_die(-1, "number too large\n");
+				scanner.value = scanner.value * 10 + (ch - '0');
+				scanner.in_number = true;
+				continue;
+			}
+			if (scanner.in_number == false)
+				continue;
+
+			machine_batch_store(batch, scanner.field,
+				scanner.value);
+			scanner.field = (scanner.field + 1) % MACHINE_FIELDS;
+			scanner.value = 0;
+			scanner.in_number = false;
+			if (batch->count == MACHINE_BATCH)
+				minimium_token += solve_machine_batch(batch);
 		}
-		//printf("smallest token: %lld\n", smallest_token);
-	}	
-	return minimium_token;
-}
+	}
 
-static void release_all_move_codes(struct aoc_dlist_node *move_codes)
-{
-	struct aoc_dlist_node *node;
-	assert(move_codes != NULL);
-	for (node = move_codes->next ; node != move_codes;) {
-		struct move_code *move_code;
-		struct aoc_dlist_node *tmp;
-		tmp = node->next;
-		move_code = aoc_dlist_container(node, offsetof(struct move_code, node));
-		free(move_code);
-		node = tmp;
-	}	
-	return;
+	/* the last number may run up to the end of the file */
+	if (scanner.in_number == true) {
+		machine_batch_store(batch, scanner.field, scanner.value);
+		scanner.field = (scanner.field + 1) % MACHINE_FIELDS;
+	}
+	assert(scanner.field == 0);
+	minimium_token += solve_machine_batch(batch);
+	free(batch);
+	return minimium_token;
 }
 
 int main(void)
 {
-	struct aoc_lncache *button_config_file;
-	struct aoc_dlist_node move_codes;
+	FILE *input;
 	long long minimium_tokens;
 
-	if ((button_config_file = aoc_new_lncache("input")) == NULL) {
+	if ((input = fopen("input", "r")) == NULL) {
 		aoc_die(-1, "cannot open file [%s]\n", "input");
 	}
 
-	aoc_dlist_init(&move_codes);
-	create_cheat_code_list(button_config_file, &move_codes);
-	
-	minimium_tokens = get_minimum_token(&move_codes);
+	minimium_tokens = get_minimum_token(input);
 	printf("token %lld\n", minimium_tokens);
 
-	release_all_move_codes(&move_codes);
-	aoc_free_lncache(button_config_file);
+	fclose(input);
 	return 0;
 }
-
@@ -2,83 +2,123 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
 
 #include <aoc/lncache.h>
-#include <aoc/mapcache.h>
 #include <aoc/die.h>
-#include <aoc/bot.h>
-#include <aoc/dlist.h>
 
-struct coord {
-	int x;
-	int y;
+/* lobby size in tiles, set from the configuration */
+#ifndef LOBBY_WIDTH
+#define LOBBY_WIDTH	101
+#endif
+#ifndef LOBBY_HEIGHT
+#define LOBBY_HEIGHT	103
+#endif
+
+/* the robots as parallel arrays, one entry per robot. velocities are kept
+ * reduced into [0, size). */
+struct robot_swarm {
+#define ROBOT_SWARM_SIZE	1024
+	int32_t *start_x;
+	int32_t *start_y;
+	int32_t *velocity_x;
+	int32_t *velocity_y;
+	int32_t *x; /* position after simulation */
+	int32_t *y;
+	size_t count;
+	size_t capacity;
 };
 
-/* for reference, we assign the quadrants like so:
- *  0 | 1
- *  --+--
- *  3 | 2
- */
-struct quadrant_coords {
-	struct coord min;
-	struct coord max;
-};
-
-struct robot_struct {
-	struct aoc_bot *bot;
-	struct coord position;
-	struct coord velocity;
-	struct coord final; /* x,y after simulation */
-	int (*move_horizontal)(struct aoc_mapcache *);
-	int (*move_vertical)(struct aoc_mapcache *);
-	struct aoc_dlist_node node; /* next robot */
-};
+/* the vector type the swarm is counted in */
+typedef int32_t swarm_vec __attribute__((vector_size(32)));
+#define SWARM_LANES	(sizeof(swarm_vec) / sizeof(int32_t))
 
-struct robot_struct *new_robot(int px, int py, int vx, int vy)
+static inline void swarm_vec_load(swarm_vec *v, const int32_t *column)
 {
-	struct robot_struct *robot;
-	struct aoc_bot *bot;
-	enum aoc_direction bot_direction;
+	memcpy(v, column, sizeof * v);
+	return;
+}
 
-	bot_direction = aoc_direction_right;
-	if (vx < 0) {
-		bot_direction = aoc_direction_left;
-	}
+static struct robot_swarm *new_robot_swarm(void)
+{
+	struct robot_swarm *swarm;
+	swarm = malloc(sizeof * swarm);
+	assert(swarm != NULL);
+	swarm->start_x = NULL;
+	swarm->start_y = NULL;
+	swarm->velocity_x = NULL;
+	swarm->velocity_y = NULL;
+	swarm->x = NULL;
+	swarm->y = NULL;
+	swarm->count = 0;
+	swarm->capacity = 0;
+	return swarm;
+}
 
-	robot = malloc(sizeof * robot);
-	assert(robot != NULL);
-	
-	bot = aoc_new_bot(bot_direction);
-	assert(bot != NULL);
-	robot->bot = bot;
-	robot->position.x = px;
-	robot->position.y = py;
-	robot->velocity.x = abs(vx);
-	robot->velocity.y = abs(vy);
+static void free_robot_swarm(struct robot_swarm *swarm)
+{
+	assert(swarm != NULL);
+	free(swarm->start_x);
+	free(swarm->start_y);
+	free(swarm->velocity_x);
+	free(swarm->velocity_y);
+	free(swarm->x);
+	free(swarm->y);
+	free(swarm);
+	return;
+}
 
-	robot->move_horizontal = aoc_mapcache_warp_right;
-	if(vx < 0) {
-		robot->move_horizontal = aoc_mapcache_warp_left;
-	}
+static int32_t *enlarge_column(int32_t *column, size_t capacity)
+{
+	column = realloc(column, capacity * sizeof * column);
+	assert(column != NULL);
+	return column;
+}
 
-	robot->move_vertical = aoc_mapcache_warp_down;
-	if (vy < 0) {
-		robot->move_vertical = aoc_mapcache_warp_up;
-	}
+static void robot_swarm_enlarge(struct robot_swarm *swarm)
+{
+	size_t new_capacity;
+	new_capacity = swarm->capacity ? swarm->capacity * 2 : ROBOT_SWARM_SIZE;
+	swarm->start_x = enlarge_column(swarm->start_x, new_capacity);
+	swarm->start_y = enlarge_column(swarm->start_y, new_capacity);
+	swarm->velocity_x = enlarge_column(swarm->velocity_x, new_capacity);
+	swarm->velocity_y = enlarge_column(swarm->velocity_y, new_capacity);
+	swarm->x = enlarge_column(swarm->x, new_capacity);
+	swarm->y = enlarge_column(swarm->y, new_capacity);
+	swarm->capacity = new_capacity;
+	return;
+}
 
-	return robot;
+static int32_t reduce_velocity(int v, int size)
+{
+	v %= size;
+	if (v < 0)
+		v += size;
+	return v;
 }
 
-static void free_robot(struct robot_struct *robot)
+static void robot_swarm_add(struct robot_swarm *swarm, int px, int py,
+	int vx, int vy)
 {
-	assert(robot != NULL);
-	assert(robot->bot != NULL);
-	aoc_free_bot(robot->bot);
-	free(robot);
+	size_t i;
+	assert(swarm != NULL);
+	assert((px >= 0) && (px < LOBBY_WIDTH));
+	assert((py >= 0) && (py < LOBBY_HEIGHT));
+	if (swarm->count == swarm->capacity)
+		robot_swarm_enlarge(swarm);
+	i = swarm->count;
+	swarm->start_x[i] = px;
+	swarm->start_y[i] = py;
+	swarm->velocity_x[i] = reduce_velocity(vx, LOBBY_WIDTH);
+	swarm->velocity_y[i] = reduce_velocity(vy, LOBBY_HEIGHT);
+	swarm->x[i] = px;
+	swarm->y[i] = py;
+	swarm->count += 1;
 	return;
 }
 
-static void add_new_robot(struct aoc_dlist_node *robot_list,
+static void add_new_robot(struct robot_swarm *swarm,
 	struct aoc_line *robot_line)
 {
 	char buffer[256];
@@ -87,8 +127,7 @@ static void add_new_robot(struct aoc_dlist_node *robot_list,
 	int py;
 	int vx;
 	int vy;
-	struct robot_struct *r;
-	assert(robot_list != NULL);
+	assert(swarm != NULL);
 	assert(robot_line != NULL);
 	line_len = aoc_line_strlen(robot_line);
 	assert(line_len < sizeof buffer);
@@ -96,298 +135,140 @@ static void add_new_robot(struct aoc_dlist_node *robot_list,
 	sscanf(buffer, "p=%d,%d v=%d,%d", &px, &py, &vx, &vy);
 	//printf("p=%d,%d v=%d,%d\n", px, py, vx, vy);
 
-	r = new_robot(px, py, vx, vy);
-	assert(r != NULL);
-
-	aoc_dlist_append(robot_list->prev, &r->node);
-
+	robot_swarm_add(swarm, px, py, vx, vy);
 	return;
 }
 
-static void create_robot_list(struct aoc_lncache *robot_input,
-	struct aoc_dlist_node *robot_list)
+static void create_robot_swarm(struct aoc_lncache *robot_input,
+	struct robot_swarm *swarm)
 {
 	size_t i;
 	size_t robot_line_count;
 	assert(robot_input != NULL);
-	assert(robot_list != NULL);
+	assert(swarm != NULL);
 	robot_line_count = aoc_lncache_line_count(robot_input);
 	for (i = 0; i < robot_line_count; i += 1) {
 		struct aoc_line *robot_line;
 		aoc_lncache_getline(robot_input, &robot_line, i);
-		add_new_robot(robot_list, robot_line);
+		add_new_robot(swarm, robot_line);
 	}
 	return;
 }
 
-static void release_all_robots(struct aoc_dlist_node *robot_list)
+/* the lobby wraps around, so after t seconds a robot sits at
+ * (p + v * t) mod size along each axis. v is already reduced, and so is
+ * t before the product is taken. */
+static int32_t wrap_position(int32_t p, int32_t v, long long t, int size)
 {
-	struct aoc_dlist_node *node;
-	assert(robot_list != NULL);
-	for (node = robot_list->next; node != robot_list; ) {
-		struct aoc_dlist_node *tmp = node->next;
-		struct robot_struct *robot;
-		robot = aoc_dlist_container(node, offsetof(struct robot_struct, node));
-		free_robot(robot);
-		node = tmp;
-	}
-
-	return;
+	return (p + (long long)v * (t % size)) % size;
 }
 
-static void move_horizontal(struct aoc_mapcache *ebhq,
-	struct robot_struct *robot)
+static void simulate_all_robots(struct robot_swarm *swarm,
+	long long total_seconds)
 {
-	int i;
-	assert(ebhq != NULL);
-	assert(robot != NULL);
-	assert(robot->move_horizontal != NULL);
-	for (i = 0; i < robot->velocity.x; i += 1) {
-		robot->move_horizontal(ebhq);
-	}
-	return;
-}
-
-static void move_vertical(struct aoc_mapcache *ebhq,
-	struct robot_struct *robot)
-{
-	int i;
-	assert(ebhq != NULL);
-	assert(robot != NULL);
-	assert(robot->move_vertical != NULL);
-	for (i = 0; i < robot->velocity.y; i += 1) {
-		robot->move_vertical(ebhq);
+	size_t i;
+	assert(swarm != NULL);
+	assert(total_seconds >= 0);
+	for (i = 0; i < swarm->count; i += 1) {
+		swarm->x[i] = wrap_position(swarm->start_x[i],
+			swarm->velocity_x[i], total_seconds, LOBBY_WIDTH);
+		swarm->y[i] = wrap_position(swarm->start_y[i],
+			swarm->velocity_y[i], total_seconds, LOBBY_HEIGHT);
 	}
 	return;
 }
 
-static void move_robot(struct aoc_mapcache *ebhq, struct robot_struct *robot)
-{
-	assert(ebhq != NULL);
-	assert(robot != NULL);
-	move_horizontal(ebhq, robot);
-	move_vertical(ebhq, robot);
-	return;
-}
-
-static void robot_set_start_position(struct aoc_mapcache *ebhq,
-	struct robot_struct *robot)
-{
-	int i;
-	assert(ebhq != NULL);
-	assert(robot != NULL);
-
-	aoc_mapcache_reset(ebhq);
-
-	/* x is horizontal */
-	for (i = 0; i < robot->position.x; i += 1) 
-		aoc_mapcache_step_right(ebhq);
-
-	/* y is vertical */
-	for (i = 0; i < robot->position.y; i += 1)
-		aoc_mapcache_step_down(ebhq);
-
-	return;
-}
-
-static void robot_set_final_position(struct aoc_mapcache *ebhq,
-	struct robot_struct *robot)
-{
-	int x;
-	int y;
-	assert(ebhq != NULL);
-	assert(robot != NULL);
-	aoc_mapcache_coord(ebhq, &x, &y);
-	robot->final.x = x;
-	robot->final.y = y;
-	return;
-}
-
-static int robot_get_quadrant(struct aoc_mapcache *ebhq,
-	struct robot_struct *robot);
+/* the product of four quadrant counts, wide enough for large swarms */
+typedef unsigned __int128 safety_t;
 
-static void simulate_one_robot(struct aoc_mapcache *ebhq,
-	struct robot_struct *robot, int total_seconds)
-{
-	int seconds;
-	assert(ebhq != NULL);
-	assert(robot != NULL);
-	assert(total_seconds > 0);
-	robot_set_start_position(ebhq, robot);
-	for (seconds = 0; seconds < total_seconds; seconds += 1) {
-		move_robot(ebhq, robot);
-	}
-	robot_set_final_position(ebhq, robot);
-	return;
-}
-
-static void simulate_all_robots(struct aoc_mapcache *ebhq,
-	struct aoc_dlist_node *robot_list, int total_seconds)
+/* for reference, we assign the quadrants like so:
+ *  0 | 1
+ *  --+--
+ *  3 | 2
+ * robots on the middle lines belong to no quadrant. every lane compares
+ * its robot against both middle lines and the resulting masks, -1 when
+ * true, are subtracted from the per lane quadrant counts. */
+static safety_t lab_safety_factor(struct robot_swarm *swarm)
 {
-	struct aoc_dlist_node *node;
-
-	assert(ebhq != NULL);
-	assert(robot_list != NULL);
-	for (node = robot_list->next; node != robot_list; node = node->next) {
-		struct robot_struct *robot;
-		robot = aoc_dlist_container(node, offsetof(struct robot_struct, node));
-		assert(robot != NULL);
+	const int32_t mid_x = LOBBY_WIDTH >> 1;
+	const int32_t mid_y = LOBBY_HEIGHT >> 1;
+	swarm_vec q0 = { 0 };
+	swarm_vec q1 = { 0 };
+	swarm_vec q2 = { 0 };
+	swarm_vec q3 = { 0 };
+	unsigned long long robot_counts_per_quadrant[4] = {0,0,0,0};
+	size_t lane;
+	size_t i;
 
-		simulate_one_robot(ebhq, robot, total_seconds);
+	assert(swarm != NULL);
+	for (i = 0; i + SWARM_LANES <= swarm->count; i += SWARM_LANES) {
+		swarm_vec x;
+		swarm_vec y;
+		swarm_vec left;
+		swarm_vec right;
+		swarm_vec top;
+		swarm_vec bottom;
+		swarm_vec_load(&x, &swarm->x[i]);
+		swarm_vec_load(&y, &swarm->y[i]);
+		left = x < mid_x;
+		right = x > mid_x;
+		top = y < mid_y;
+		bottom = y > mid_y;
+		q0 -= left & top;
+		q1 -= right & top;
+		q2 -= right & bottom;
+		q3 -= left & bottom;
 	}
-	return;
-}
-
-static void set_quadrant0_coords(struct aoc_mapcache *ebhq,
-	struct quadrant_coords *quadrant)
-{
-	assert(ebhq != NULL);
-	assert(quadrant != NULL);
-	
-	quadrant->min.x = 0;
-	quadrant->min.y = 0;
-	quadrant->max.x = (aoc_mapcache_height(ebhq) >> 1);
-	quadrant->max.y = (aoc_mapcache_width(ebhq) >> 1);
-	return;
-}
-
-static void set_quadrant1_coords(struct aoc_mapcache *ebhq,
-	struct quadrant_coords *quadrant)
-{
-	assert(ebhq != NULL);
-	assert(quadrant != NULL);
-
-	quadrant->min.x = 0;
-	quadrant->min.y = (aoc_mapcache_width(ebhq) >> 1) + 1;
-	quadrant->max.x = aoc_mapcache_height(ebhq) >> 1;
-	quadrant->max.y = aoc_mapcache_width(ebhq);
-
-	return;
-}
-
-static void set_quadrant2_coords(struct aoc_mapcache *ebhq,
-	struct quadrant_coords *quadrant)
-{
-	assert(ebhq != NULL);
-	assert(quadrant != NULL);
-
-	quadrant->min.x = (aoc_mapcache_height(ebhq) >> 1) + 1;
-	quadrant->min.y = (aoc_mapcache_width(ebhq) >> 1) + 1;
-	quadrant->max.x = aoc_mapcache_height(ebhq);
-	quadrant->max.y = aoc_mapcache_width(ebhq);
-	return;
-}
-
-static void set_quadrant3_coords(struct aoc_mapcache *ebhq,
-	struct quadrant_coords *quadrant)
-{
-	assert(ebhq != NULL);
-	assert(quadrant != NULL);
-
-	quadrant->min.x = (aoc_mapcache_height(ebhq) >> 1) + 1;
-	quadrant->min.y = 0;
-	quadrant->max.x = aoc_mapcache_height(ebhq);
-	quadrant->max.y = (aoc_mapcache_width(ebhq) >> 1);
-	return;
-}
-
-static bool robot_in_quadrant(struct robot_struct *robot,
-	struct quadrant_coords *quad_coords)
-{
-	assert(robot != NULL);
-	assert(quad_coords != NULL);
-
-	if (    (robot->final.x >= quad_coords->min.x) &&
-		(robot->final.x < quad_coords->max.x)) {
-		if (    (robot->final.y >= quad_coords->min.y) &&
-			(robot->final.y < quad_coords->max.y)) {
-			return true;
-		}
+	for (lane = 0; lane < SWARM_LANES; lane += 1) {
+		robot_counts_per_quadrant[0] += q0[lane];
+		robot_counts_per_quadrant[1] += q1[lane];
+		robot_counts_per_quadrant[2] += q2[lane];
+		robot_counts_per_quadrant[3] += q3[lane];
 	}
-	return false;
-}
-
-static int robot_get_quadrant(struct aoc_mapcache *ebhq,
-	struct robot_struct *robot)
-{
-	static struct quadrant_coords q0 = {0};
-	static struct quadrant_coords q1 = {0};
-	static struct quadrant_coords q2 = {0};
-	static struct quadrant_coords q3 = {0};
-	static bool quadrant_coords_set = false;
-
-	if (quadrant_coords_set == false) {
-		assert(ebhq != NULL);
-		set_quadrant0_coords(ebhq, &q0);
-		set_quadrant1_coords(ebhq, &q1);
-		set_quadrant2_coords(ebhq, &q2);
-		set_quadrant3_coords(ebhq, &q3);
-		quadrant_coords_set = true;
+	for (; i < swarm->count; i += 1) {
+		int32_t x = swarm->x[i];
+		int32_t y = swarm->y[i];
+		if ((x == mid_x) || (y == mid_y))
+			continue;
+		if (y < mid_y)
+			robot_counts_per_quadrant[x < mid_x ? 0 : 1] += 1;
+		else
+			robot_counts_per_quadrant[x < mid_x ? 3 : 2] += 1;
 	}
-	
-	assert(robot != NULL);
-	if (robot_in_quadrant(robot, &q0) == true)
-		return 0;
-	
-	if (robot_in_quadrant(robot, &q1) == true)
-		return 1;
 
-	if (robot_in_quadrant(robot, &q2) == true)
-		return 2;
-
-	if (robot_in_quadrant(robot, &q3) == true)
-		return 3;
-
-	return -1;
+	return (safety_t)robot_counts_per_quadrant[0] * robot_counts_per_quadrant[1] *
+		robot_counts_per_quadrant[2] * 	robot_counts_per_quadrant[3];
 }
 
-static int lab_safety_factor(struct aoc_mapcache *ebhq, struct aoc_dlist_node *robot_list)
+static void print_safety_factor(safety_t safety_factor)
 {
-	int robot_counts_per_quadrant[4] = {0,0,0,0};
-	struct aoc_dlist_node *node;
-	assert(robot_list != NULL);
-	for (node = robot_list->next; node != robot_list; node = node->next) {
-		struct robot_struct *robot;
-		int quad_index;
-		robot = aoc_dlist_container(node, offsetof(struct robot_struct, node));
-		quad_index = robot_get_quadrant(ebhq, robot);
-		switch(quad_index) {
-		case 0:
-		case 1:
-		case 2:
-		case 3:
-			robot_counts_per_quadrant[quad_index] += 1;
-			break;
-		default:
-			/* nothing */
-		}
-	}
-
-	return robot_counts_per_quadrant[0] * robot_counts_per_quadrant[1] *
-		robot_counts_per_quadrant[2] * 	robot_counts_per_quadrant[3];
+	char digits[40];
+	int i = sizeof digits - 1;
+	digits[i] = '\0';
+	do {
+		i -= 1;
+		digits[i] = '0' + (int)(safety_factor % 10);
+		safety_factor /= 10;
+	} while (safety_factor != 0);
+	printf("Lab safety factor: %s\n", &digits[i]);
+	return;
 }
 
 int main()
 {
 	struct aoc_lncache *robot_input;
-	struct aoc_dlist_node robot_list;
-	struct aoc_mapcache *ebhq;
-	int safety_factor;
+	struct robot_swarm *swarm;
+	safety_t safety_factor;
 
 	robot_input = aoc_new_lncache("input");
-	aoc_dlist_init(&robot_list);
-	create_robot_list(robot_input, &robot_list);
-
-	ebhq = aoc_new_mapcache_grid(103, 101, '.');
-	assert(ebhq != NULL);
+	swarm = new_robot_swarm();
+	create_robot_swarm(robot_input, swarm);
 
-	simulate_all_robots(ebhq, &robot_list, 100);
-	safety_factor = lab_safety_factor(ebhq, &robot_list);
-	printf("Lab safety factor: %d\n", safety_factor);
+	simulate_all_robots(swarm, 100);
+	safety_factor = lab_safety_factor(swarm);
+	print_safety_factor(safety_factor);
 
-	release_all_robots(&robot_list);
+	free_robot_swarm(swarm);
 	aoc_free_lncache(robot_input);
-	aoc_free_mapcache(ebhq);
 	return 0;
 }
-
@@ -2,72 +2,132 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
 
 #include <aoc/lncache.h>
 #include <aoc/mapcache.h>
 #include <aoc/die.h>
-#include <aoc/bot.h>
-#include <aoc/dlist.h>
 
-struct coord {
-	int x;
-	int y;
+/* lobby size in tiles, set from the configuration */
+#ifndef LOBBY_WIDTH
+#define LOBBY_WIDTH	101
+#endif
+#ifndef LOBBY_HEIGHT
+#define LOBBY_HEIGHT	103
+#endif
+
+/* the robots as parallel arrays, one entry per robot. velocities are kept
+ * reduced into [0, size) so that a step is an add and a single wrap. */
+struct robot_swarm {
+#define ROBOT_SWARM_SIZE	1024
+	int32_t *start_x;
+	int32_t *start_y;
+	int32_t *velocity_x;
+	int32_t *velocity_y;
+	int32_t *x; /* position after simulation */
+	int32_t *y;
+	size_t count;
+	size_t capacity;
 };
 
-struct robot_struct {
-	struct aoc_bot *bot;
-	struct coord position;
-	struct coord velocity;
-	int (*move_horizontal)(struct aoc_mapcache *);
-	int (*move_vertical)(struct aoc_mapcache *);
-	struct aoc_dlist_node node; /* next robot */
-};
+/* the vector type the swarm is stepped in */
+typedef int32_t swarm_vec __attribute__((vector_size(32)));
+#define SWARM_LANES	(sizeof(swarm_vec) / sizeof(int32_t))
+typedef long long swarm_wide_vec
+	__attribute__((vector_size(SWARM_LANES * sizeof(long long))));
 
-struct robot_struct *new_robot(int px, int py, int vx, int vy)
+static inline void swarm_vec_load(swarm_vec *v, const int32_t *column)
 {
-	struct robot_struct *robot;
-	struct aoc_bot *bot;
-	enum aoc_direction bot_direction;
+	memcpy(v, column, sizeof * v);
+	return;
+}
 
-	bot_direction = aoc_direction_right;
-	if (vx < 0) {
-		bot_direction = aoc_direction_left;
-	}
+static inline void swarm_vec_store(int32_t *column, const swarm_vec *v)
+{
+	memcpy(column, v, sizeof * v);
+	return;
+}
 
-	robot = malloc(sizeof * robot);
-	assert(robot != NULL);
-	
-	bot = aoc_new_bot(bot_direction);
-	assert(bot != NULL);
-	robot->bot = bot;
-	robot->position.x = px;
-	robot->position.y = py;
-	robot->velocity.x = abs(vx);
-	robot->velocity.y = abs(vy);
-
-	robot->move_horizontal = aoc_mapcache_warp_right;
-	if(vx < 0) {
-		robot->move_horizontal = aoc_mapcache_warp_left;
-	}
+static struct robot_swarm *new_robot_swarm(void)
+{
+	struct robot_swarm *swarm;
+	swarm = malloc(sizeof * swarm);
+	assert(swarm != NULL);
+	swarm->start_x = NULL;
+	swarm->start_y = NULL;
+	swarm->velocity_x = NULL;
+	swarm->velocity_y = NULL;
+	swarm->x = NULL;
+	swarm->y = NULL;
+	swarm->count = 0;
+	swarm->capacity = 0;
+	return swarm;
+}
 
-	robot->move_vertical = aoc_mapcache_warp_down;
-	if (vy < 0) {
-		robot->move_vertical = aoc_mapcache_warp_up;
-	}
+static void free_robot_swarm(struct robot_swarm *swarm)
+{
+	assert(swarm != NULL);
+	free(swarm->start_x);
+	free(swarm->start_y);
+	free(swarm->velocity_x);
+	free(swarm->velocity_y);
+	free(swarm->x);
+	free(swarm->y);
+	free(swarm);
+	return;
+}
+
+static int32_t *enlarge_column(int32_t *column, size_t capacity)
+{
+	column = realloc(column, capacity * sizeof * column);
+	assert(column != NULL);
+	return column;
+}
+
+static void robot_swarm_enlarge(struct robot_swarm *swarm)
+{
+	size_t new_capacity;
+	new_capacity = swarm->capacity ? swarm->capacity * 2 : ROBOT_SWARM_SIZE;
+	swarm->start_x = enlarge_column(swarm->start_x, new_capacity);
+	swarm->start_y = enlarge_column(swarm->start_y, new_capacity);
+	swarm->velocity_x = enlarge_column(swarm->velocity_x, new_capacity);
+	swarm->velocity_y = enlarge_column(swarm->velocity_y, new_capacity);
+	swarm->x = enlarge_column(swarm->x, new_capacity);
+	swarm->y = enlarge_column(swarm->y, new_capacity);
+	swarm->capacity = new_capacity;
+	return;
+}
 
-	return robot;
+static int32_t reduce_velocity(int v, int size)
+{
+	v %= size;
+	if (v < 0)
+		v += size;
+	return v;
 }
 
-static void free_robot(struct robot_struct *robot)
+static void robot_swarm_add(struct robot_swarm *swarm, int px, int py,
+	int vx, int vy)
 {
-	assert(robot != NULL);
-	assert(robot->bot != NULL);
-	aoc_free_bot(robot->bot);
-	free(robot);
+	size_t i;
+	assert(swarm != NULL);
+	assert((px >= 0) && (px < LOBBY_WIDTH));
+	assert((py >= 0) && (py < LOBBY_HEIGHT));
+	if (swarm->count == swarm->capacity)
+		robot_swarm_enlarge(swarm);
+	i = swarm->count;
+	swarm->start_x[i] = px;
+	swarm->start_y[i] = py;
+	swarm->velocity_x[i] = reduce_velocity(vx, LOBBY_WIDTH);
+	swarm->velocity_y[i] = reduce_velocity(vy, LOBBY_HEIGHT);
+	swarm->x[i] = px;
+	swarm->y[i] = py;
+	swarm->count += 1;
 	return;
 }
 
-static void add_new_robot(struct aoc_dlist_node *robot_list,
+static void add_new_robot(struct robot_swarm *swarm,
 	struct aoc_line *robot_line)
 {
 	char buffer[256];
@@ -76,8 +136,7 @@ static void add_new_robot(struct aoc_dlist_node *robot_list,
 	int py;
 	int vx;
 	int vy;
-	struct robot_struct *r;
-	assert(robot_list != NULL);
+	assert(swarm != NULL);
 	assert(robot_line != NULL);
 	line_len = aoc_line_strlen(robot_line);
 	assert(line_len < sizeof buffer);
@@ -85,215 +144,279 @@ static void add_new_robot(struct aoc_dlist_node *robot_list,
 	sscanf(buffer, "p=%d,%d v=%d,%d", &px, &py, &vx, &vy);
 	//printf("p=%d,%d v=%d,%d\n", px, py, vx, vy);
 
-	r = new_robot(px, py, vx, vy);
-	assert(r != NULL);
-
-	aoc_dlist_append(robot_list->prev, &r->node);
-
+	robot_swarm_add(swarm, px, py, vx, vy);
 	return;
 }
 
-static void create_robot_list(struct aoc_lncache *robot_input,
-	struct aoc_dlist_node *robot_list)
+static void create_robot_swarm(struct aoc_lncache *robot_input,
+	struct robot_swarm *swarm)
 {
 	size_t i;
 	size_t robot_line_count;
 	assert(robot_input != NULL);
-	assert(robot_list != NULL);
+	assert(swarm != NULL);
 	robot_line_count = aoc_lncache_line_count(robot_input);
 	for (i = 0; i < robot_line_count; i += 1) {
 		struct aoc_line *robot_line;
 		aoc_lncache_getline(robot_input, &robot_line, i);
-		add_new_robot(robot_list, robot_line);
+		add_new_robot(swarm, robot_line);
 	}
 	return;
 }
 
-static void release_all_robots(struct aoc_dlist_node *robot_list)
+/* the lobby wraps around, so after t seconds a robot sits at
+ * (p + v * t) mod size along each axis. v is already reduced, and so is
+ * t before the product is taken. */
+static int32_t wrap_position(int32_t p, int32_t v, long long t, int size)
 {
-	struct aoc_dlist_node *node;
-	assert(robot_list != NULL);
-	for (node = robot_list->next; node != robot_list; ) {
-		struct aoc_dlist_node *tmp = node->next;
-		struct robot_struct *robot;
-		robot = aoc_dlist_container(node, offsetof(struct robot_struct, node));
-		free_robot(robot);
-		node = tmp;
-	}
-
-	return;
+	return (p + (long long)v * (t % size)) % size;
 }
 
-static void move_horizontal(struct aoc_mapcache *ebhq,
-	struct robot_struct *robot)
+static void simulate_all_robots(struct robot_swarm *swarm,
+	long long total_seconds)
 {
-	int i;
-	assert(ebhq != NULL);
-	assert(robot != NULL);
-	assert(robot->move_horizontal != NULL);
-	for (i = 0; i < robot->velocity.x; i += 1) {
-		robot->move_horizontal(ebhq);
+	size_t i;
+	assert(swarm != NULL);
+	assert(total_seconds >= 0);
+	for (i = 0; i < swarm->count; i += 1) {
+		swarm->x[i] = wrap_position(swarm->start_x[i],
+			swarm->velocity_x[i], total_seconds, LOBBY_WIDTH);
+		swarm->y[i] = wrap_position(swarm->start_y[i],
+			swarm->velocity_y[i], total_seconds, LOBBY_HEIGHT);
 	}
 	return;
 }
 
-static void move_vertical(struct aoc_mapcache *ebhq,
-	struct robot_struct *robot)
+/* move every robot on by one second. positions and velocities both lie
+ * in [0, size), so their sum wraps by subtracting size at most once. */
+static void step_one_column(int32_t *position, const int32_t *velocity,
+	size_t count, int32_t size)
 {
-	int i;
-	assert(ebhq != NULL);
-	assert(robot != NULL);
-	assert(robot->move_vertical != NULL);
-	for (i = 0; i < robot->velocity.y; i += 1) {
-		robot->move_vertical(ebhq);
+	size_t i;
+	for (i = 0; i + SWARM_LANES <= count; i += SWARM_LANES) {
+		swarm_vec p;
+		swarm_vec v;
+		swarm_vec_load(&p, &position[i]);
+		swarm_vec_load(&v, &velocity[i]);
+		p += v;
+		p -= (p >= size) & size;
+		swarm_vec_store(&position[i], &p);
+	}
+	for (; i < count; i += 1) {
+		position[i] += velocity[i];
+		if (position[i] >= size)
+			position[i] -= size;
 	}
 	return;
 }
 
-static void move_robot(struct aoc_mapcache *ebhq, struct robot_struct *robot)
+static void step_all_robots(struct robot_swarm *swarm)
 {
-	assert(ebhq != NULL);
-	assert(robot != NULL);
-	move_horizontal(ebhq, robot);
-	move_vertical(ebhq, robot);
+	assert(swarm != NULL);
+	step_one_column(swarm->x, swarm->velocity_x, swarm->count, LOBBY_WIDTH);
+	step_one_column(swarm->y, swarm->velocity_y, swarm->count, LOBBY_HEIGHT);
 	return;
 }
 
-static void robot_set_start_position(struct aoc_mapcache *ebhq,
-	struct robot_struct *robot)
-{
-	int i;
-	assert(ebhq != NULL);
-	assert(robot != NULL);
-
-	aoc_mapcache_reset(ebhq);
-
-	/* x is horizontal */
-	for (i = 0; i < robot->position.x; i += 1) 
-		aoc_mapcache_step_right(ebhq);
-
-	/* y is vertical */
-	for (i = 0; i < robot->position.y; i += 1)
-		aoc_mapcache_step_down(ebhq);
+struct axis_moments {
+	unsigned long long sum;
+	unsigned long long sum_squared;
+};
 
-	aoc_mapcache_change_tile(ebhq, '.');
+/* sum and sum of squares of a column, widened to 64 bit lanes so the
+ * squares themselves can't overflow. the variance is worked out from
+ * these in 128 bits. */
+static void column_moments(const int32_t *column, size_t count,
+	struct axis_moments *moments)
+{
+	swarm_wide_vec sum = { 0 };
+	swarm_wide_vec sum_squared = { 0 };
+	size_t lane;
+	size_t i;
 
+	for (i = 0; i + SWARM_LANES <= count; i += SWARM_LANES) {
+		swarm_vec v;
+		swarm_wide_vec wide;
+		swarm_vec_load(&v, &column[i]);
+		wide = __builtin_convertvector(v, swarm_wide_vec);
+		sum += wide;
+		sum_squared += wide * wide;
+	}
+	moments->sum = 0;
+	moments->sum_squared = 0;
+	for (lane = 0; lane < SWARM_LANES; lane += 1) {
+		moments->sum += sum[lane];
+		moments->sum_squared += sum_squared[lane];
+	}
+	for (; i < count; i += 1) {
+		moments->sum += column[i];
+		moments->sum_squared += (unsigned long long)column[i] * column[i];
+	}
 	return;
 }
 
-static void robot_update_position(struct aoc_mapcache *ebhq,
-	struct robot_struct *robot) 
+struct axis_variance {
+	unsigned long long x;
+	unsigned long long y;
+};
+
+/* (n * sum(v^2) - sum(v)^2) / (n * (n - 1)). both products exceed 64 bits
+ * for large lobbies or swarms, the variance itself is below size^2. */
+static unsigned long long axis_variance(struct axis_moments *moments,
+	unsigned long long count)
 {
-	assert(ebhq != NULL);
-	assert(robot != NULL);
-	aoc_mapcache_coord(ebhq, &robot->position.y, &robot->position.x);
-	aoc_mapcache_change_tile(ebhq, '*');
-	return;
+	unsigned __int128 spread;
+	spread = (unsigned __int128)count * moments->sum_squared -
+		(unsigned __int128)moments->sum * moments->sum;
+	return spread / ((unsigned __int128)count * (count - 1));
 }
 
-static void simulate_one_robot(struct aoc_mapcache *ebhq,
-	struct robot_struct *robot, int total_seconds)
+static void compute_2d_variance(struct robot_swarm *swarm,
+	struct axis_variance *variance)
 {
-	int seconds;
-	assert(ebhq != NULL);
-	assert(robot != NULL);
-	assert(total_seconds > 0);
-	robot_set_start_position(ebhq, robot);
-	for (seconds = 0; seconds < total_seconds; seconds += 1) {
-		move_robot(ebhq, robot);
-	}
-	robot_update_position(ebhq, robot);
+	struct axis_moments mx;
+	struct axis_moments my;
+	unsigned long long count;
+
+	assert(swarm != NULL);
+	assert(variance != NULL);
+	count = swarm->count;
+	assert(count > 1);
+
+	column_moments(swarm->x, swarm->count, &mx);
+	column_moments(swarm->y, swarm->count, &my);
+	variance->x = axis_variance(&mx, count);
+	variance->y = axis_variance(&my, count);
 	return;
 }
 
-static void simulate_all_robots(struct aoc_mapcache *ebhq,
-	struct aoc_dlist_node *robot_list, int total_seconds)
+/* draw the lobby as it is after the last simulation. robots are laid out
+ * in a flat occupancy grid first, so the mapcache is walked only once. */
+static struct aoc_mapcache *render_all_robots(struct robot_swarm *swarm)
 {
-	struct aoc_dlist_node *node;
+	struct aoc_mapcache *ebhq;
+	bool *occupied;
+	size_t i;
 
-	assert(ebhq != NULL);
-	assert(robot_list != NULL);
-	for (node = robot_list->next; node != robot_list; node = node->next) {
-		struct robot_struct *robot;
-		robot = aoc_dlist_container(node, offsetof(struct robot_struct, node));
-		assert(robot != NULL);
+	assert(swarm != NULL);
+	occupied = calloc((size_t)LOBBY_WIDTH * LOBBY_HEIGHT, sizeof * occupied);
+	assert(occupied != NULL);
+	for (i = 0; i < swarm->count; i += 1)
+		occupied[(size_t)swarm->y[i] * LOBBY_WIDTH + swarm->x[i]] = true;
 
-		simulate_one_robot(ebhq, robot, total_seconds);
+	ebhq = aoc_new_mapcache_grid(LOBBY_HEIGHT, LOBBY_WIDTH, '.');
+	assert(ebhq != NULL);
+	aoc_mapcache_reset(ebhq);
+	for (;;) {
+		int row;
+		int col;
+		aoc_mapcache_coord(ebhq, &row, &col);
+		if (occupied[(size_t)row * LOBBY_WIDTH + col] == true)
+			aoc_mapcache_change_tile(ebhq, '*');
+		if (aoc_mapcache_walk_forward(ebhq) == -1)
+			break;
 	}
-	return;
+	free(occupied);
+	return ebhq;
 }
 
-static unsigned long long compute_2d_variance(struct aoc_dlist_node *robot_list)
+static long long extended_gcd(long long a, long long b, long long *x,
+	long long *y)
 {
-	struct aoc_dlist_node *node;
-	unsigned long long sumx = 0;
-	unsigned long long sumx_squared = 0;
-	unsigned long long sumy = 0;
-	unsigned long long sumy_squared = 0;
-	unsigned long long count = 0;
-
-	assert(robot_list != NULL);
-	for (node = robot_list->next; node != robot_list; node = node->next) {
-		struct robot_struct *robot;
-		robot = aoc_dlist_container(node, offsetof(struct robot_struct, node));
-		assert(robot != NULL);
-		
-		sumx += robot->position.x;
-		sumx_squared += (robot->position.x * robot->position.x);
-		sumy += robot->position.y;
-		sumy_squared += (robot->position.y * robot->position.y);
-		count += 1;
+	long long x0 = 1;
+	long long y0 = 0;
+	long long x1 = 0;
+	long long y1 = 1;
+	while (b != 0) {
+		long long q = a / b;
+		long long tmp;
+		tmp = a - q * b;
+		a = b;
+		b = tmp;
+		tmp = x0 - q * x1;
+		x0 = x1;
+		x1 = tmp;
+		tmp = y0 - q * y1;
+		y0 = y1;
+		y1 = tmp;
 	}
+	*x = x0;
+	*y = y0;
+	return a;
+}
 
-	unsigned long long xvariance;
-	unsigned long long yvariance;
+/* the time t with t = tx mod width and t = ty mod height, smallest first.
+ * t = tx + width * k, where width * k = ty - tx mod height. */
+static long long combine_times(long long tx, long long ty)
+{
+	long long inverse;
+	long long unused;
+	long long k;
+
+	if (extended_gcd(LOBBY_WIDTH, LOBBY_HEIGHT, &inverse, &unused) != 1)
+		aoc_die(-1, "lobby width and height must be coprime\n");
+	k = ((ty - tx) % LOBBY_HEIGHT) * (inverse % LOBBY_HEIGHT) % LOBBY_HEIGHT;
+	if (k < 0)
+		k += LOBBY_HEIGHT;
+	return tx + (long long)LOBBY_WIDTH * k;
+}
 
-	xvariance = (count * sumx_squared - sumx * sumx) / (count * (count-1));
-	yvariance = (count * sumy_squared - sumy * sumy) / (count * (count-1));
+/* x positions repeat every width seconds and y positions every height
+ * seconds, and the picture is where robots bunch up along both axes. the
+ * x variance is lowest at some tx < width and the y variance at some
+ * ty < height, each found on its own. the picture appears at the time
+ * matching both, given by the chinese remainder theorem. the frames are
+ * consecutive, so the swarm is stepped from one to the next. */
+static long long find_easter_egg(struct robot_swarm *swarm)
+{
+	struct axis_variance smallest;
+	struct axis_variance variance;
+	int frame_count;
+	int tx = 0;
+	int ty = 0;
+	int i;
 
-	return xvariance + yvariance;
+	assert(swarm != NULL);
+	frame_count = LOBBY_WIDTH > LOBBY_HEIGHT ? LOBBY_WIDTH : LOBBY_HEIGHT;
+	simulate_all_robots(swarm, 0);
+	compute_2d_variance(swarm, &smallest);
+	for (i = 1; i < frame_count; i += 1) {
+		step_all_robots(swarm);
+		compute_2d_variance(swarm, &variance);
+		if ((i < LOBBY_WIDTH) && (variance.x < smallest.x)) {
+			smallest.x = variance.x;
+			tx = i;
+		}
+		if ((i < LOBBY_HEIGHT) && (variance.y < smallest.y)) {
+			smallest.y = variance.y;
+			ty = i;
+		}
+	}
+	return combine_times(tx, ty);
 }
 
 int main()
 {
 	struct aoc_lncache *robot_input;
-	struct aoc_dlist_node robot_list;
+	struct robot_swarm *swarm;
 	struct aoc_mapcache *ebhq;
-	struct aoc_mapcache *ebhq_snapshot = NULL;
+	long long time_step;
 
 	robot_input = aoc_new_lncache("input");
-	aoc_dlist_init(&robot_list);
-	create_robot_list(robot_input, &robot_list);
+	swarm = new_robot_swarm();
+	create_robot_swarm(robot_input, swarm);
 
-	ebhq = aoc_new_mapcache_grid(103, 101, '.');
-	assert(ebhq != NULL);
+	time_step = find_easter_egg(swarm);
 
-	int i;
-	unsigned long long smallest_variance ;
-	unsigned long long variance_2d;
-	int time_step;
-	variance_2d = compute_2d_variance(&robot_list);
-	smallest_variance = variance_2d;
-	for (i = 0; i < 7500; i += 1) {
-		variance_2d = compute_2d_variance(&robot_list);
-		if (variance_2d < smallest_variance) {
-			if (ebhq_snapshot != NULL)
-				aoc_free_mapcache(ebhq_snapshot);
-			ebhq_snapshot = aoc_mapcache_dup(ebhq);
-			smallest_variance = variance_2d;
-			time_step = i;
-		}
-
-		simulate_all_robots(ebhq, &robot_list, 1);
-	}
-	printf("possible easter egg appearance at : %d, displaying map...", time_step);
-	aoc_mapcache_show(ebhq_snapshot);
+	/* only the winning frame is drawn */
+	simulate_all_robots(swarm, time_step);
+	ebhq = render_all_robots(swarm);
+	printf("possible easter egg appearance at : %lld, displaying map...", time_step);
+	aoc_mapcache_show(ebhq);
 	printf("\n");
-	
-	release_all_robots(&robot_list);
+
+	free_robot_swarm(swarm);
 	aoc_free_lncache(robot_input);
-	aoc_free_mapcache(ebhq_snapshot);
 	aoc_free_mapcache(ebhq);
 	return 0;
 }
-
@@ -1,210 +1,450 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <assert.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
 
 #include <aoc/mapcache.h>
-#include <aoc/bot.h>
-#include <aoc/lut.h>
 #include <aoc/die.h>
 
-static void init_guard_starting_point(struct aoc_mapcache *lab,
-	unsigned long guard_start_tile_id)
+/* the lab copied out of the mapcache into a flat row-major tile array. all
+ * simulations only read it; a candidate blocker is never written into the
+ * lab, each simulation carries it around instead.
+ * the guard can only turn on a tile next to an obstruction. those turn
+ * tiles are numbered, so loop detection logs need one entry per turn tile
+ * rather than one per tile. */
+struct lab_grid {
+#define NO_TURN_SLOT	UINT32_MAX
+	char *tiles;
+	int width;
+	int height;
+	size_t tile_count;
+	uint32_t *turn_slots; /* turn tile number, or NO_TURN_SLOT */
+	size_t turn_count;
+	int guard_start_row;
+	int guard_start_col;
+};
+
+/* headings in turn-right order: up, right, down, left */
+static const int heading_drow[4] = { -1, 0, 1, 0 };
+static const int heading_dcol[4] = { 0, 1, 0, -1 };
+
+static inline bool lab_grid_inside(struct lab_grid *grid, int row, int col)
 {
-	aoc_mapcache_goto_tile(lab, guard_start_tile_id);
-	assert(aoc_mapcache_tile(lab, NULL) == '^');
+	return (row >= 0) && (row < grid->height) &&
+		(col >= 0) && (col < grid->width);
+}
+
+/* number every tile that has an obstruction next to it */
+static void lab_grid_number_turns(struct lab_grid *grid)
+{
+	int row;
+	int col;
+
+	grid->turn_slots = malloc(grid->tile_count * sizeof * grid->turn_slots);
+	assert(grid->turn_slots != NULL);
+	grid->turn_count = 0;
+	for (row = 0; row < grid->height; row += 1) {
+		for (col = 0; col < grid->width; col += 1) {
+			size_t tile = (size_t)row * grid->width + col;
+			int heading;
+			grid->turn_slots[tile] = NO_TURN_SLOT;
+			if (grid->tiles[tile] == '#')
+				continue;
+			for (heading = 0; heading < 4; heading += 1) {
+				int r = row + heading_drow[heading];
+				int c = col + heading_dcol[heading];
+				if ((lab_grid_inside(grid, r, c) == true) &&
+					(grid->tiles[(size_t)r * grid->width + c] == '#'))
+					break;
+			}
+			if (heading == 4)
+				continue;
+			assert(grid->turn_count < NO_TURN_SLOT);
+			grid->turn_slots[tile] = grid->turn_count;
+			grid->turn_count += 1;
+		}
+	}
 	return;
 }
 
-static int lab_peek_direction(struct aoc_mapcache *lab,
-	enum aoc_direction dir)
-{
-	switch(dir) {
-	case aoc_direction_up:
-		return aoc_mapcache_peek_up(lab);
-	case aoc_direction_right:
-		return aoc_mapcache_peek_right(lab);
-	case aoc_direction_down:
-		return aoc_mapcache_peek_down(lab);
-	case aoc_direction_left:
-		return aoc_mapcache_peek_left(lab);
-	default:
-		break;
+static struct lab_grid *new_lab_grid(struct aoc_mapcache *lab)
+{
+	struct lab_grid *grid;
+	bool guard_found = false;
+	assert(lab != NULL);
+
+	grid = malloc(sizeof * grid);
+	assert(grid != NULL);
+	grid->width = aoc_mapcache_width(lab);
+	grid->height = aoc_mapcache_height(lab);
+	grid->tile_count = (size_t)grid->width * grid->height;
+	grid->tiles = malloc(grid->tile_count);
+	assert(grid->tiles != NULL);
+
+	aoc_mapcache_reset(lab);
+	for (;;) {
+		int tile;
+		int row;
+		int col;
+		tile = aoc_mapcache_tile(lab, NULL);
+		aoc_mapcache_coord(lab, &row, &col);
+		grid->tiles[(size_t)row * grid->width + col] = (char)tile;
+
+		/* record the guard starting position */
+		if (tile == '^') {
+			grid->guard_start_row = row;
+			grid->guard_start_col = col;
+			guard_found = true;
+		}
+
+		if (aoc_mapcache_walk_forward(lab) == -1)
+			break;
 	}
+	assert(guard_found == true);
+	lab_grid_number_turns(grid);
+	return grid;
+}
 
-	/* we never go here. */
-	assert(0);
-	return -1;
+static void free_lab_grid(struct lab_grid *grid)
+{
+	assert(grid != NULL);
+	free(grid->turn_slots);
+	free(grid->tiles);
+	free(grid);
+	return;
 }
 
-static int guard_peek_front(struct aoc_mapcache *lab, struct aoc_bot *guard)
+/* loop detection log of one simulation lane. only turns are logged: a
+ * guard that turns twice on the same tile to the same heading is walking
+ * in a loop. every (turn slot, heading) state owns a 4-bit epoch stamp,
+ * four headings packed into one 16-bit word per slot. there is a slot per
+ * turn tile of the lab, and PATROL_BLOCKER_SLOTS more for the tiles next
+ * to the candidate blocker, one per heading the guard meets it with.
+ * a state was visited in the current simulation if its stamp equals
+ * the current epoch, so starting a new simulation only bumps the epoch.
+ * the log is wiped once every PATROL_EPOCH_MAX simulations when the epoch
+ * wraps around. */
+struct patrol_log {
+#define PATROL_EPOCH_BITS	4
+#define PATROL_EPOCH_MAX	((1 << PATROL_EPOCH_BITS) - 1)
+#define PATROL_BLOCKER_SLOTS	4
+	uint16_t *stamps;
+	size_t slot_count;
+	unsigned int epoch;
+};
+
+static void init_patrol_log(struct patrol_log *log, size_t turn_count)
 {
-	enum aoc_direction front;
-	assert(lab != NULL);
-	assert(guard != NULL);
-	front = aoc_bot_get_front(guard);
-	return lab_peek_direction(lab, front);
+	assert(log != NULL);
+	log->slot_count = turn_count + PATROL_BLOCKER_SLOTS;
+	log->stamps = calloc(log->slot_count, sizeof * log->stamps);
+	assert(log->stamps != NULL);
+	log->epoch = 0;
+	return;
 }
 
-static void guard_turn_right(struct aoc_bot *guard)
+static void release_patrol_log(struct patrol_log *log)
 {
-	assert(guard != NULL);
-	aoc_bot_turn_right(guard);
+	assert(log != NULL);
+	free(log->stamps);
+	log->stamps = NULL;
 	return;
 }
 
-static void lab_walk_direction(struct aoc_mapcache *lab,
-	enum aoc_direction dir)
-{
-	switch(dir) {
-	case aoc_direction_up:
-		aoc_mapcache_step_up(lab);
-		break;
-	case aoc_direction_right:
-		aoc_mapcache_step_right(lab);
-		break;
-	case aoc_direction_down:
-		aoc_mapcache_step_down(lab);
-		break;
-	case aoc_direction_left:
-		aoc_mapcache_step_left(lab);
-		break;
-	default:
-		break;
+/* start a new simulation. stamps from older epochs are stale now. */
+static void patrol_log_next_epoch(struct patrol_log *log)
+{
+	assert(log != NULL);
+	log->epoch += 1;
+	if (log->epoch > PATROL_EPOCH_MAX) {
+		memset(log->stamps, 0, log->slot_count * sizeof * log->stamps);
+		log->epoch = 1;
 	}
 	return;
 }
 
-static void guard_walk_forward(struct aoc_mapcache *lab,
-	struct aoc_bot *guard)
+/* stamp a turn slot and heading. returns true if the guard has turned
+ * here to the same heading during this simulation. */
+static bool patrol_log_visit(struct patrol_log *log, size_t slot, int heading)
 {
-	enum aoc_direction front;
-	assert(lab != NULL);
-	assert(guard != NULL);
-	front = aoc_bot_get_front(guard);
-	lab_walk_direction(lab, front);
-	return;
+	unsigned int shift;
+	uint16_t *stamp;
+
+	assert(slot < log->slot_count);
+	stamp = &log->stamps[slot];
+	shift = heading * PATROL_EPOCH_BITS;
+	if (((*stamp >> shift) & PATROL_EPOCH_MAX) == log->epoch)
+		return true;
+	*stamp &= ~(PATROL_EPOCH_MAX << shift);
+	*stamp |= log->epoch << shift;
+	return false;
 }
 
-struct tile_info {
-	enum aoc_direction guard_last_direction;
+/* one in-flight simulation. a worker keeps PATROL_LANES of these and
+ * advances them round-robin, one move each per round, so that the cache
+ * misses of one lane overlap with the work on the others. */
+struct patrol_lane {
+	struct patrol_log log;
+	size_t blocker;	/* tile index of the candidate obstruction */
+	int row;
+	int col;
+	int heading;
+	bool active;
+};
+
+enum patrol_state {
+	patrol_running,
+	patrol_escaped,
+	patrol_trapped,
 };
 
-static int simulate_guard_patrol(struct aoc_mapcache *lab,
-	unsigned long guard_start_tile_id)
+/* prefetch whatever the lane touches on its next move: the tile in front
+ * and, in case that is a blocker, the turn slot of the tile it stands on.
+ * the log itself only has an entry per turn tile and stays cache sized. */
+static inline void patrol_lane_prefetch(struct lab_grid *grid,
+	struct patrol_lane *lane, size_t tile)
+{
+	int row = lane->row + heading_drow[lane->heading];
+	int col = lane->col + heading_dcol[lane->heading];
+	if (lab_grid_inside(grid, row, col)) {
+		__builtin_prefetch(&grid->tiles[(size_t)row * grid->width + col]);
+	}
+	__builtin_prefetch(&grid->turn_slots[tile]);
+	return;
+}
+
+static void patrol_lane_start(struct lab_grid *grid, struct patrol_lane *lane,
+	size_t blocker)
 {
-	struct aoc_bot *guard;
-	struct aoc_lut *lab_lut;
-	bool guard_has_stepped_out = false;
+	size_t tile;
+	lane->blocker = blocker;
+	lane->row = grid->guard_start_row;
+	lane->col = grid->guard_start_col;
+	lane->heading = 0; /* guard starts facing up */
+	lane->active = true;
+	patrol_log_next_epoch(&lane->log);
+	tile = (size_t)lane->row * grid->width + lane->col;
+	patrol_lane_prefetch(grid, lane, tile);
+	return;
+}
 
-	guard = aoc_new_bot(aoc_direction_up);
-	lab_lut = aoc_new_lut(12, sizeof(unsigned long), sizeof(struct tile_info));
+/* advance a lane by a single move: either one step forward or one turn. */
+static enum patrol_state patrol_lane_step(struct lab_grid *grid,
+	struct patrol_lane *lane)
+{
+	int row;
+	int col;
+	size_t tile;
 
-	/* initialize the map with the guard starting tile */
-	init_guard_starting_point(lab, guard_start_tile_id);
-	
-	for (;;) {
-		int tile;
-		unsigned long tile_id;
+	row = lane->row + heading_drow[lane->heading];
+	col = lane->col + heading_dcol[lane->heading];
 
-		/* peek guard front so he can try to walk forward */
-		tile = guard_peek_front(lab, guard);
+	/* if guard can walk out from this tile. simulation is done. */
+	if (lab_grid_inside(grid, row, col) == false)
+		return patrol_escaped;
 
-		/* if guard can walk out from this tile. simulation is done. */
-		if (tile == -1) {
-			guard_has_stepped_out = true;
-			break;
-		}
-		
-		/* if tile is a blocker e.g. it is '#', guard needs to 
-		 * turn right */
-		if (tile == '#') {
-			int ret;
-			struct tile_info info;
-			enum aoc_direction guard_direction;
-
-			/* guard might need to turn two times */
-			while(tile == '#') {
-				guard_turn_right(guard);
-				tile = guard_peek_front(lab, guard);
-			}
-			aoc_mapcache_tile(lab, &tile_id);
-			guard_direction = aoc_bot_get_front(guard);
-			ret = aoc_lut_lookup(lab_lut, &tile_id, sizeof tile_id,
-				&info, sizeof info);
-			if (ret == 0) {
-				/* guard is trapped! */
-				if (info.guard_last_direction == guard_direction) {
-					break;
-				}
-			} else {
-				info.guard_last_direction = guard_direction;
-				aoc_lut_add(lab_lut, &tile_id, sizeof tile_id,
-					&info, sizeof info);
-			}
-		}
-		
-		guard_walk_forward(lab, guard);
+	tile = (size_t)row * grid->width + col;
+	if ((grid->tiles[tile] == '#') || (tile == lane->blocker)) {
+		size_t slot;
+		/* the tile in front of the blocker for a given heading is
+		 * always the same, so the heading picks its slot. */
+		if (tile == lane->blocker)
+			slot = grid->turn_count + lane->heading;
+		else
+			slot = grid->turn_slots[(size_t)lane->row * grid->width +
+				lane->col];
+		assert(slot != NO_TURN_SLOT);
+		/* guard is trapped if it already turned on this tile and
+		 * left facing the same heading. */
+		tile = (size_t)lane->row * grid->width + lane->col;
+		lane->heading = (lane->heading + 1) & 3;
+		if (patrol_log_visit(&lane->log, slot, lane->heading) == true)
+			return patrol_trapped;
+	} else {
+		lane->row = row;
+		lane->col = col;
 	}
 
-	aoc_free_lut(lab_lut);
-	aoc_free_bot(guard);
-	return guard_has_stepped_out == true ? 0 : -1;
+	patrol_lane_prefetch(grid, lane, tile);
+	return patrol_running;
 }
 
-int main(void)
+/* work shared by all workers. candidates are handed out in batches of
+ * PATROL_BATCH blocker tiles. */
+struct patrol_job {
+#define PATROL_LANES	16
+#define PATROL_BATCH	(PATROL_LANES * 4)
+	struct lab_grid *grid;
+	size_t *candidates;
+	size_t candidate_count;
+	size_t next_candidate; /* atomic */
+};
+
+struct patrol_worker {
+	pthread_t thread;
+	struct patrol_job *job;
+	struct patrol_lane lanes[PATROL_LANES];
+	size_t next; /* next candidate of our current batch */
+	size_t end;
+	int trapped_count;
+};
+
+static bool patrol_worker_next_candidate(struct patrol_worker *worker,
+	size_t *blocker)
 {
-	struct aoc_mapcache *lab;
-	unsigned long guard_start_tile_id = 0;
-	int guard_trapped_count = 0;
+	struct patrol_job *job = worker->job;
+	if (worker->next == worker->end) {
+		size_t start;
+		start = __atomic_fetch_add(&job->next_candidate, PATROL_BATCH,
+			__ATOMIC_RELAXED);
+		if (start >= job->candidate_count)
+			return false;
+		worker->next = start;
+		worker->end = start + PATROL_BATCH;
+		if (worker->end > job->candidate_count)
+			worker->end = job->candidate_count;
+	}
+	*blocker = job->candidates[worker->next];
+	worker->next += 1;
+	return true;
+}
 
-	if ((lab = aoc_new_mapcache("input")) == NULL) {
-		aoc_die(-1, "cannot open input file [%s]\n", "input");
+static void patrol_worker_load_lane(struct patrol_worker *worker,
+	struct patrol_lane *lane)
+{
+	size_t blocker;
+	if (patrol_worker_next_candidate(worker, &blocker) == true) {
+		patrol_lane_start(worker->job->grid, lane, blocker);
+	} else {
+		lane->active = false;
+	}
+	return;
+}
+
+static void *patrol_worker_run(void *param)
+{
+	struct patrol_worker *worker = param;
+	struct lab_grid *grid = worker->job->grid;
+	size_t i;
+
+	for (i = 0; i < PATROL_LANES; i += 1) {
+		patrol_worker_load_lane(worker, &worker->lanes[i]);
 	}
 
-	/* record the guard starting position */
 	for (;;) {
-		int tile;
-		unsigned long tile_id;
-		tile = aoc_mapcache_tile(lab, &tile_id);
-		if (tile == '^') {
-			guard_start_tile_id = tile_id;
-			break;
-		}
+		int running = 0;
+		for (i = 0; i < PATROL_LANES; i += 1) {
+			struct patrol_lane *lane = &worker->lanes[i];
+			enum patrol_state state;
+			if (lane->active == false)
+				continue;
+			running += 1;
+			state = patrol_lane_step(grid, lane);
+			if (state == patrol_running)
+				continue;
+			if (state == patrol_trapped)
+				worker->trapped_count += 1;
 
-		if (aoc_mapcache_walk_forward(lab) == -1)
+			/* this lane is done. refill it with a new candidate */
+			patrol_worker_load_lane(worker, lane);
+		}
+		if (running == 0)
 			break;
 	}
-	assert(guard_start_tile_id != 0);
+	return NULL;
+}
 
-	aoc_mapcache_reset(lab);
-	for (;;) {
-		int tile;
-		unsigned long tile_id;
+static int worker_count(void)
+{
+	long count;
+	count = sysconf(_SC_NPROCESSORS_ONLN);
+	if (count < 1)
+		count = 1;
+	if (count > 64)
+		count = 64;
+	return (int)count;
+}
 
-		/* add blocker to tile if we can */
-		tile = aoc_mapcache_tile(lab, &tile_id);
-		if (tile == '.')
-			aoc_mapcache_change_tile(lab, '#');
+/* every empty tile is a candidate for the new obstruction. */
+static size_t collect_candidates(struct lab_grid *grid, size_t **candidates)
+{
+	size_t count = 0;
+	size_t tile;
+	*candidates = malloc(grid->tile_count * sizeof ** candidates);
+	assert(*candidates != NULL);
+	for (tile = 0; tile < grid->tile_count; tile += 1) {
+		if (grid->tiles[tile] == '.') {
+			(*candidates)[count] = tile;
+			count += 1;
+		}
+	}
+	return count;
+}
 
-		/* now we can start simulation */
-		if (simulate_guard_patrol(lab, guard_start_tile_id) == -1)
-			guard_trapped_count += 1;
+static int count_trapping_blockers(struct lab_grid *grid)
+{
+	struct patrol_job job;
+	struct patrol_worker *workers;
+	int nr_workers;
+	int trapped_count = 0;
+	int i;
 
-		/* simulation might have ruined our lab position, 
-		 * restore it first to where we were before simulation */
-		aoc_mapcache_goto_tile(lab, tile_id);
+	job.grid = grid;
+	job.candidate_count = collect_candidates(grid, &job.candidates);
+	job.next_candidate = 0;
 
-		/* if we added a blocker to this tile, remove it */
-		if (tile == '.')
-			aoc_mapcache_change_tile(lab, '.');
+	nr_workers = worker_count();
+	workers = calloc(nr_workers, sizeof * workers);
+	assert(workers != NULL);
+	for (i = 0; i < nr_workers; i += 1) {
+		struct patrol_worker *worker = &workers[i];
+		size_t lane;
+		worker->job = &job;
+		worker->next = worker->end = 0;
+		worker->trapped_count = 0;
+		for (lane = 0; lane < PATROL_LANES; lane += 1) {
+			init_patrol_log(&worker->lanes[lane].log,
+				grid->turn_count);
+		}
+		if (pthread_create(&worker->thread, NULL, patrol_worker_run,
+			worker) != 0) {
+			aoc_die(-1, "cannot create patrol worker\n");
+		}
+	}
 
-		if (aoc_mapcache_walk_forward(lab) == -1)
-			break;
+	for (i = 0; i < nr_workers; i += 1) {
+		struct patrol_worker *worker = &workers[i];
+		size_t lane;
+		pthread_join(worker->thread, NULL);
+		trapped_count += worker->trapped_count;
+		for (lane = 0; lane < PATROL_LANES; lane += 1) {
+			release_patrol_log(&worker->lanes[lane].log);
+		}
+	}
+
+	free(workers);
+	free(job.candidates);
+	return trapped_count;
+}
 
+int main(void)
+{
+	struct aoc_mapcache *lab;
+	struct lab_grid *grid;
+	int guard_trapped_count;
+
+	if ((lab = aoc_new_mapcache("input")) == NULL) {
+		aoc_die(-1, "cannot open input file [%s]\n", "input");
 	}
+	grid = new_lab_grid(lab);
+	aoc_free_mapcache(lab);
 
+	guard_trapped_count = count_trapping_blockers(grid);
 	printf("distinct blocker positions: %d\n", guard_trapped_count);
-	aoc_free_mapcache(lab);
+	free_lab_grid(grid);
 	return 0;
 }
-
@@ -2,69 +2,140 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <stdbool.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
 
 #define MAX_LINE_SIZE	1024
 
-struct eq_struct {
-#define NUM_COUNT	4
-	unsigned long long test_value; /* appears before the colon */
-	size_t size;
-	size_t count;
+/* 10^0 up to 10^19, the largest power of ten that fits 64 bits */
+static const unsigned long long pow10_table[] = {
+	1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL,
+	10000000ULL, 100000000ULL, 1000000000ULL, 10000000000ULL,
+	100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+	100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+	100000000000000000ULL, 1000000000000000000ULL,
+	10000000000000000000ULL,
+};
+
+#define POW10_TABLE_SIZE	(sizeof pow10_table / sizeof pow10_table[0])
+
+/* the power of ten that shifts a number left by as many digits as num has,
+ * i.e. x || num == x * num_pow10(num) + num. numbers with 20 digits don't
+ * have one; 0 is returned for them and no concatenation is possible. */
+static unsigned long long num_pow10(unsigned long long num)
+{
+	size_t digits = 1;
+	while ((digits < POW10_TABLE_SIZE) && (num >= pow10_table[digits]))
+		digits += 1;
+	return digits < POW10_TABLE_SIZE ? pow10_table[digits] : 0;
+}
+
+/* all equations live in one columnar store. the numbers of every equation
+ * are laid out back to back in numbers[]; equation i owns counts[i] of them
+ * starting at offsets[i]. the solver then walks sequential memory instead
+ * of chasing list nodes. */
+struct eq_store {
+#define EQ_STORE_SIZE	64
+	unsigned long long *test_values; /* appears before the colon */
+	size_t *offsets;
+	size_t *counts;
+	size_t eq_count;
+	size_t eq_size;
 	unsigned long long *numbers;
-	struct eq_struct *next; /* singly */
+	unsigned long long *pow10s; /* num_pow10() of every number */
+	size_t num_count;
+	size_t num_size;
 };
 
-static struct eq_struct *list_head;
-static struct eq_struct *list_tail;
+static void init_eq_store(struct eq_store *store)
+{
+	store->test_values = NULL;
+	store->offsets = NULL;
+	store->counts = NULL;
+	store->eq_count = 0;
+	store->eq_size = 0;
+	store->numbers = NULL;
+	store->pow10s = NULL;
+	store->num_count = 0;
+	store->num_size = 0;
+	return;
+}
+
+static void release_eq_store(struct eq_store *store)
+{
+	free(store->test_values);
+	free(store->offsets);
+	free(store->counts);
+	free(store->numbers);
+	free(store->pow10s);
+	init_eq_store(store);
+	return;
+}
+
+static void *enlarge_column(void *column, size_t size, size_t elem_size)
+{
+	column = realloc(column, size * elem_size);
+	if (column == NULL) {
+		fprintf(stderr, "error allocating memory for eq store\n");
+		exit(-1);
+	}
+	return column;
+}
 
-static void eq_append_num(struct eq_struct *eq, int num)
+static void eq_store_append_num(struct eq_store *store,
+	unsigned long long num)
 {
-	unsigned long long *new_numbers;
-	size_t new_size;
-	while (eq->count >= eq->size) {
-		new_size = eq->size + NUM_COUNT;
-		new_numbers = realloc(eq->numbers, sizeof(unsigned long long) * new_size);
-		assert(new_numbers != NULL);
-		eq->numbers = new_numbers;
-		eq->size = new_size;
+	if (store->num_count == store->num_size) {
+		store->num_size = store->num_size ? store->num_size * 2 :
+			EQ_STORE_SIZE;
+		store->numbers = enlarge_column(store->numbers,
+			store->num_size, sizeof * store->numbers);
+		store->pow10s = enlarge_column(store->pow10s,
+			store->num_size, sizeof * store->pow10s);
 	}
-	eq->numbers[eq->count] = num;
-	eq->count += 1;
+	store->numbers[store->num_count] = num;
+	store->pow10s[store->num_count] = num_pow10(num);
+	store->num_count += 1;
 	return;
 }
 
-static struct eq_struct *eq_init(struct eq_struct *eq, char *line)
+static void eq_store_append_eq(struct eq_store *store, char *line)
 {
 	unsigned long long num;
 	char *next;
+	size_t eq;
+
+	if (store->eq_count == store->eq_size) {
+		store->eq_size = store->eq_size ? store->eq_size * 2 :
+			EQ_STORE_SIZE;
+		store->test_values = enlarge_column(store->test_values,
+			store->eq_size, sizeof * store->test_values);
+		store->offsets = enlarge_column(store->offsets,
+			store->eq_size, sizeof * store->offsets);
+		store->counts = enlarge_column(store->counts,
+			store->eq_size, sizeof * store->counts);
+	}
+	eq = store->eq_count;
+
 	num = strtoull(line, &next, 10);
 	assert(*next == ':');
-	eq->test_value = (unsigned long long)num;
-	eq->size = 0;
-	eq->count = 0;
-	eq->numbers = NULL;
+	store->test_values[eq] = num;
+	store->offsets[eq] = store->num_count;
 	
 	next += 1;
-	num = strtol(next, &next, 10);
+	num = strtoull(next, &next, 10);
 	while(*next != '\0') {
-		eq_append_num(eq, num);
+		eq_store_append_num(store, num);
 		next += 1;
-		num = strtol(next, &next, 10);
+		num = strtoull(next, &next, 10);
 	}
-	return eq;
-}
-
-static struct eq_struct *alloc_eq(char *line)
-{
-	struct eq_struct *eq;
-	if ((eq = malloc(sizeof * eq)) == NULL) {
-		fprintf(stderr, "error allocating memory for eq object\n");
-		exit(-1);
-	}
-	return eq_init(eq, line);
+	store->counts[eq] = store->num_count - store->offsets[eq];
+	store->eq_count += 1;
+	return;
 }
 
-
 #if 0
 we need to test all the possible combinations of + or * and for day 2, an 
 additonal || operator or "concatenate" two numbers. for a list of numbers
@@ -103,86 +174,444 @@ For example: if we this eq line -> 292: 11 6 16 20.
 
 #endif
 
-static bool test_eq(struct eq_struct *eq, unsigned long long num, size_t idx)
+/* the tree above grows as 3^(n-1) when walked forward from the first number.
+ * instead, we walk it backward from the test value and undo the last
+ * operator at every level. each operator can only be undone under some
+ * condition, which prunes almost every branch:
+ *
+ * 	value = x + num  only if value >= num, then x = value - num
+ * 	value = x * num  only if num divides value, then x = value / num
+ * 	value = x || num only if value ends with the digits of num, then
+ * 	                 x = value with those digits chopped off
+ *
+ * we reach the first number with x == numbers[0] if the equation holds. */
+static bool test_eq(const unsigned long long *numbers,
+	const unsigned long long *pow10s, unsigned long long value, size_t idx)
+{
+	unsigned long long num = numbers[idx];
+	unsigned long long pow10 = pow10s[idx];
+
+	if (idx == 0)
+		return value == num;
+	idx -= 1;
+
+	/* undo the || path first. it prunes the hardest. */
+	if ((pow10 != 0) && ((value % pow10) == num)) {
+		if (test_eq(numbers, pow10s, value / pow10, idx) == true)
+			return true;
+	}
+
+	/* then undo the * path. anything times zero is zero. */
+	if (num == 0) {
+		if (value == 0)
+			return true;
+	} else if ((value % num) == 0) {
+		if (test_eq(numbers, pow10s, value / num, idx) == true)
+			return true;
+	}
+
+	/* and undo the + path last */
+	if (value >= num) {
+		return test_eq(numbers, pow10s, value - num, idx);
+	}
+	return false;
+}
+
+/* short equations are cheaper to brute force than to search: every operator
+ * combination is evaluated forward, EQ_SIMD_LANES combinations at a time in
+ * the lanes of a vector. a lane holds a combination as an operator mask with
+ * two bits per operator (0: +, 1: *, 2: ||, 3: unused), and a vector compare
+ * against the test value tells if any lane matched. a lane that overflows
+ * 64 bits on the way is dropped. equations with at most EQ_SIMD_CUTOVER
+ * numbers go to this evaluator, longer ones to test_eq(). */
+#ifndef EQ_SIMD_CUTOVER
+#define EQ_SIMD_CUTOVER	4
+#endif
+#define EQ_SIMD_MAX_COUNT	8 /* longer ones are split first, see EQ_SPLIT_COUNT */
+#define EQ_SIMD_LANES	4
+
+typedef unsigned long long eq_vec __attribute__((vector_size(EQ_SIMD_LANES *
+	sizeof(unsigned long long))));
+typedef long long eq_mask __attribute__((vector_size(EQ_SIMD_LANES *
+	sizeof(long long))));
+
+static bool eq_mask_any(const eq_mask *mask)
 {
+	int i;
+	for (i = 0; i < EQ_SIMD_LANES; i += 1) {
+		if ((*mask)[i] != 0)
+			return true;
+	}
+	return false;
+}
 
-	if (idx < (eq->count-1)) {
-		idx += 1;
+static bool test_eq_simd(const unsigned long long *numbers,
+	const unsigned long long *pow10s, unsigned long long value, size_t idx)
+{
+	static const eq_vec lane_ids = { 0, 1, 2, 3 };
+	unsigned long long add_limit[EQ_SIMD_MAX_COUNT];
+	unsigned long long mul_limit[EQ_SIMD_MAX_COUNT];
+	unsigned long long cat_limit[EQ_SIMD_MAX_COUNT];
+	unsigned long long mask_count;
+	unsigned long long base;
+	size_t i;
 
-		/* check the + path first */
-		if (test_eq(eq, num + eq->numbers[idx], idx) == false) {
+	assert(idx < EQ_SIMD_MAX_COUNT);
 
-			/* if it fails, check the * path */
-			if (test_eq(eq, num * eq->numbers[idx], idx) == false) {
+	/* the largest accumulator each operator takes without overflowing */
+	for (i = 1; i <= idx; i += 1) {
+		unsigned long long num = numbers[i];
+		add_limit[i] = ULLONG_MAX - num;
+		mul_limit[i] = ULLONG_MAX / num;
+		cat_limit[i] = pow10s[i] != 0 ? (ULLONG_MAX - num) / pow10s[i] : 0;
+	}
 
-				unsigned long long cc_num;
-				char concat_string[512] = {0};
+	mask_count = 1ULL << (2 * idx);
+	for (base = 0; base < mask_count; base += EQ_SIMD_LANES) {
+		eq_vec ops = lane_ids + base;
+		eq_vec acc = (eq_vec){0} + numbers[0];
+		eq_mask dead = (eq_mask)(ops >= mask_count);
+		eq_mask hit;
 
-				sprintf(concat_string, "%llu%llu", num, eq->numbers[idx]);
-				cc_num = strtoull(concat_string, NULL, 10);
+		for (i = 1; i <= idx; i += 1) {
+			eq_vec op = ops & 3;
+			eq_mask is_add = (eq_mask)(op == 0);
+			eq_mask is_mul = (eq_mask)(op == 1);
+			eq_mask is_cat = (eq_mask)(op == 2);
+			eq_vec sum = acc + numbers[i];
+			eq_vec product = acc * numbers[i];
+			eq_vec concat = acc * pow10s[i] + numbers[i];
 
-				/* check the || path last if everything fails */
-				return (test_eq(eq, cc_num, idx));
-			}
+			dead |= (eq_mask)(op == 3);
+			dead |= is_add & (eq_mask)(acc > add_limit[i]);
+			dead |= is_mul & (eq_mask)(acc > mul_limit[i]);
+			dead |= is_cat & (eq_mask)(acc > cat_limit[i]);
+			acc = (sum & (eq_vec)is_add) | (product & (eq_vec)is_mul) |
+				(concat & (eq_vec)is_cat);
+			ops >>= 2;
 		}
-		return true;
+
+		hit = (eq_mask)(acc == value) & ~dead;
+		if (eq_mask_any(&hit) == true)
+			return true;
+	}
+	return false;
+}
+
+/* route the first idx+1 numbers of an equation to the right evaluator. the
+ * forward evaluator can't reason about overflowed lanes that a later * 0
+ * would bring back, so equations with zeros always take test_eq(). */
+static bool solve_eq(const unsigned long long *numbers,
+	const unsigned long long *pow10s, unsigned long long value, size_t idx)
+{
+	size_t i;
+	if (((idx + 1) > EQ_SIMD_CUTOVER) || ((idx + 1) > EQ_SIMD_MAX_COUNT))
+		return test_eq(numbers, pow10s, value, idx);
+	for (i = 0; i <= idx; i += 1) {
+		if (numbers[i] == 0)
+			return test_eq(numbers, pow10s, value, idx);
+	}
+	return test_eq_simd(numbers, pow10s, value, idx);
+}
+
+/* everything below spreads the equations over all cores. the work is a
+ * task: "can the first idx+1 numbers of equation eq produce value?". every
+ * worker owns a deque of tasks. it pushes and pops at the tail of its own
+ * deque and, once that runs dry, steals from the head of somebody else's.
+ * long equations are not solved in one go: their top-level operator
+ * branches become tasks of their own, which idle workers can steal. */
+struct eq_task {
+#define EQ_SPLIT_COUNT	8 /* split equations with more numbers than this */
+	size_t eq;
+	unsigned long long value;
+	size_t idx;
+};
+
+struct task_deque {
+#define TASK_DEQUE_SIZE	64
+	pthread_mutex_t lock;
+	struct eq_task *tasks;
+	size_t size;
+	size_t head; /* thieves take from here */
+	size_t count;
+};
+
+struct calibration_job {
+	struct eq_store *store;
+	bool *solved; /* set by whichever task proves the equation */
+	struct task_deque *deques;
+	int nr_workers;
+	size_t pending; /* tasks pushed but not yet finished */
+};
+
+struct calibration_worker {
+	pthread_t thread;
+	struct calibration_job *job;
+	int id;
+};
+
+static void init_task_deque(struct task_deque *deque)
+{
+	pthread_mutex_init(&deque->lock, NULL);
+	deque->size = TASK_DEQUE_SIZE;
+	deque->tasks = malloc(deque->size * sizeof * deque->tasks);
+	assert(deque->tasks != NULL);
+	deque->head = 0;
+	deque->count = 0;
+	return;
+}
+
+static void release_task_deque(struct task_deque *deque)
+{
+	assert(deque->count == 0);
+	pthread_mutex_destroy(&deque->lock);
+	free(deque->tasks);
+	return;
+}
+
+/* caller holds the lock */
+static void task_deque_enlarge(struct task_deque *deque)
+{
+	struct eq_task *tasks;
+	size_t i;
+	tasks = malloc(deque->size * 2 * sizeof * tasks);
+	assert(tasks != NULL);
+	for (i = 0; i < deque->count; i += 1) {
+		tasks[i] = deque->tasks[(deque->head + i) % deque->size];
+	}
+	free(deque->tasks);
+	deque->tasks = tasks;
+	deque->size *= 2;
+	deque->head = 0;
+	return;
+}
+
+static void task_deque_push(struct task_deque *deque, struct eq_task *task)
+{
+	pthread_mutex_lock(&deque->lock);
+	if (deque->count == deque->size)
+		task_deque_enlarge(deque);
+	deque->tasks[(deque->head + deque->count) % deque->size] = *task;
+	deque->count += 1;
+	pthread_mutex_unlock(&deque->lock);
+	return;
+}
+
+/* owner side: newest task first */
+static bool task_deque_pop(struct task_deque *deque, struct eq_task *task)
+{
+	bool ok = false;
+	pthread_mutex_lock(&deque->lock);
+	if (deque->count > 0) {
+		deque->count -= 1;
+		*task = deque->tasks[(deque->head + deque->count) % deque->size];
+		ok = true;
+	}
+	pthread_mutex_unlock(&deque->lock);
+	return ok;
+}
+
+/* thief side: oldest task first */
+static bool task_deque_steal(struct task_deque *deque, struct eq_task *task)
+{
+	bool ok = false;
+	pthread_mutex_lock(&deque->lock);
+	if (deque->count > 0) {
+		*task = deque->tasks[deque->head];
+		deque->head = (deque->head + 1) % deque->size;
+		deque->count -= 1;
+		ok = true;
 	}
-	return num == eq->test_value;
+	pthread_mutex_unlock(&deque->lock);
+	return ok;
 }
 
-static bool eq_ok(struct eq_struct *eq)
+static void job_push_task(struct calibration_job *job, int id,
+	size_t eq, unsigned long long value, size_t idx)
 {
-	assert(eq->count > 1); /* we have at least two numbers in eq */
-	return test_eq(eq, eq->numbers[0], 0);
+	struct eq_task task = {
+		.eq = eq,
+		.value = value,
+		.idx = idx,
+	};
+	__atomic_add_fetch(&job->pending, 1, __ATOMIC_ACQ_REL);
+	task_deque_push(&job->deques[id], &task);
+	return;
 }
 
-static void clean_up(void)
+static void job_mark_solved(struct calibration_job *job, size_t eq)
 {
-	struct eq_struct *eq;
-	while (list_head) {
-		eq = list_head->next;
-		free(list_head->numbers);
-		free(list_head);
-		list_head = eq;
+	__atomic_store_n(&job->solved[eq], true, __ATOMIC_RELAXED);
+	return;
+}
+
+/* push every operator branch of this task that test_eq() would follow. */
+static void job_split_task(struct calibration_job *job, int id,
+	struct eq_task *task)
+{
+	struct eq_store *store = job->store;
+	size_t offset = store->offsets[task->eq] + task->idx;
+	unsigned long long num = store->numbers[offset];
+	unsigned long long pow10 = store->pow10s[offset];
+	unsigned long long value = task->value;
+	size_t idx = task->idx - 1;
+
+	if ((pow10 != 0) && ((value % pow10) == num))
+		job_push_task(job, id, task->eq, value / pow10, idx);
+
+	if (num == 0) {
+		if (value == 0)
+			job_mark_solved(job, task->eq);
+	} else if ((value % num) == 0) {
+		job_push_task(job, id, task->eq, value / num, idx);
+	}
+
+	if (value >= num)
+		job_push_task(job, id, task->eq, value - num, idx);
+	return;
+}
+
+static void job_run_task(struct calibration_job *job, int id,
+	struct eq_task *task)
+{
+	size_t offset;
+
+	/* some other branch already proved this equation */
+	if (__atomic_load_n(&job->solved[task->eq], __ATOMIC_RELAXED) == true)
+		return;
+
+	if ((task->idx + 1) > EQ_SPLIT_COUNT) {
+		job_split_task(job, id, task);
+		return;
 	}
-	list_tail = list_head = NULL;
+
+	offset = job->store->offsets[task->eq];
+	if (solve_eq(&job->store->numbers[offset], &job->store->pow10s[offset],
+		task->value, task->idx) == true)
+		job_mark_solved(job, task->eq);
 	return;
 }
 
+static bool job_steal_task(struct calibration_job *job, int id,
+	struct eq_task *task)
+{
+	int i;
+	for (i = 1; i < job->nr_workers; i += 1) {
+		int victim = (id + i) % job->nr_workers;
+		if (task_deque_steal(&job->deques[victim], task) == true)
+			return true;
+	}
+	return false;
+}
+
+static void *calibration_worker_run(void *param)
+{
+	struct calibration_worker *worker = param;
+	struct calibration_job *job = worker->job;
+	struct eq_task task;
+
+	for (;;) {
+		if ((task_deque_pop(&job->deques[worker->id], &task) == false) &&
+			(job_steal_task(job, worker->id, &task) == false)) {
+			/* nothing to do. we're finished once nobody else 
+			 * can push new tasks anymore */
+			if (__atomic_load_n(&job->pending, __ATOMIC_ACQUIRE) == 0)
+				break;
+			sched_yield();
+			continue;
+		}
+		job_run_task(job, worker->id, &task);
+		__atomic_sub_fetch(&job->pending, 1, __ATOMIC_ACQ_REL);
+	}
+	return NULL;
+}
+
+static int worker_count(void)
+{
+	long count;
+	count = sysconf(_SC_NPROCESSORS_ONLN);
+	if (count < 1)
+		count = 1;
+	if (count > 64)
+		count = 64;
+	return (int)count;
+}
+
+static unsigned long long total_calibration_result(struct eq_store *store)
+{
+	struct calibration_job job;
+	struct calibration_worker *workers;
+	unsigned long long total_calibration = 0;
+	size_t i;
+	int id;
+
+	job.store = store;
+	job.solved = calloc(store->eq_count, sizeof * job.solved);
+	assert(job.solved != NULL || store->eq_count == 0);
+	job.nr_workers = worker_count();
+	job.deques = malloc(job.nr_workers * sizeof * job.deques);
+	assert(job.deques != NULL);
+	job.pending = 0;
+	for (id = 0; id < job.nr_workers; id += 1) {
+		init_task_deque(&job.deques[id]);
+	}
+
+	/* deal the equations out to the workers */
+	for (i = 0; i < store->eq_count; i += 1) {
+		assert(store->counts[i] > 1); /* we have at least two numbers in eq */
+		job_push_task(&job, i % job.nr_workers, i, store->test_values[i],
+			store->counts[i] - 1);
+	}
+
+	workers = malloc(job.nr_workers * sizeof * workers);
+	assert(workers != NULL);
+	for (id = 0; id < job.nr_workers; id += 1) {
+		workers[id].job = &job;
+		workers[id].id = id;
+		if (pthread_create(&workers[id].thread, NULL,
+			calibration_worker_run, &workers[id]) != 0) {
+			fprintf(stderr, "cannot create calibration worker\n");
+			exit(-1);
+		}
+	}
+	for (id = 0; id < job.nr_workers; id += 1) {
+		pthread_join(workers[id].thread, NULL);
+	}
+	for (id = 0; id < job.nr_workers; id += 1) {
+		release_task_deque(&job.deques[id]);
+	}
+
+	for (i = 0; i < store->eq_count; i += 1) {
+		total_calibration += (job.solved[i] == true) ?
+			store->test_values[i] : 0;
+	}
+
+	free(workers);
+	free(job.deques);
+	free(job.solved);
+	return total_calibration;
+}
+
 int main(void)
 {
 	char line_buf[MAX_LINE_SIZE];
 	FILE *input;
-	struct eq_struct *eq;
-	unsigned long long total_calibration = 0;
+	struct eq_store store;
+	unsigned long long total_calibration;
 
 	if ((input = fopen("input", "r")) == NULL) {
 		fprintf(stderr, "cannot open input file\n");
 		exit(-1);
 	}
 
-	list_head = list_tail = NULL;
+	init_eq_store(&store);
 	while(fgets(line_buf, sizeof line_buf, input) != NULL) {
-		eq = alloc_eq(line_buf);
-		
-		/* append to list */
-		if (!list_head) {
-			assert(!list_tail);
-			list_head = list_tail = eq;
-		} else {
-			assert(list_tail && !list_tail->next);
-			list_tail->next = eq;
-			list_tail = eq;
-		}
-		
+		eq_store_append_eq(&store, line_buf);
 	}
 	fclose(input);
 
-	for (eq = list_head; eq != NULL; eq = eq->next) {
-		total_calibration += (eq_ok(eq) == true) ? eq->test_value: 0;
-	}
+	total_calibration = total_calibration_result(&store);
 	printf("total calibration result: %llu\n", total_calibration);
-	clean_up();
+	release_eq_store(&store);
 	return 0;
 }
-
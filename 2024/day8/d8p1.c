@@ -1,246 +1,426 @@
 #include <stdio.h>
-#include <sys/stat.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <limits.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <pthread.h>
+#include <unistd.h>
 
-struct antenna {
-	uintptr_t location;
-	int frequency;
-	struct antenna *next;
+struct coord {
+	int x;
+	int y;
 };
 
-struct tile_map {
-	char *buffer;
+/* the antennas of one frequency, kept as coordinates */
+struct antenna_list {
+#define ANTENNA_LIST_SIZE	8
+	struct coord *coords;
+	size_t count;
 	size_t size;
-	size_t line_size;
-	struct antenna *antenna_lut[CHAR_MAX];
 };
 
-static void init_tile_map(struct tile_map *map, char *pathname)
+#define BITS_PER_WORD	(CHAR_BIT * sizeof(unsigned long))
+#define BITMAP_WORDS(bits)	(((bits) + BITS_PER_WORD - 1) / BITS_PER_WORD)
+
+/* the set of tiles with an antinode, a tile being keyed by x * width + y.
+ * fields up to ANTINODE_BITMAP_MAX tiles get a bitmap with one bit per tile.
+ * the bitmap is shared by all workers, bits are set with an atomic or.
+ * bigger fields are taken as sparse: keys are appended to a list that is
+ * sorted and deduplicated when counted, so memory follows the number of
+ * antinodes rather than the area. every worker keeps its own key list in
+ * that case and the lists are merged once all workers are done. */
+struct antinode_set {
+#define ANTINODE_BITMAP_MAX	(1ULL << 28) /* 32MB worth of bitmap */
+#define ANTINODE_KEYS_SIZE	64
+	uint64_t tile_count;
+	unsigned long *bitmap; /* NULL in sparse mode */
+	uint64_t *keys;
+	size_t key_count;
+	size_t key_size;
+};
+
+/* the field is only known by its dimensions. there is no tile buffer, just
+ * the antenna coordinates grouped by frequency. */
+struct tile_map {
+	int width;
+	int height;
+	struct antenna_list antenna_lut[CHAR_MAX];
+	struct antinode_set antinodes;
+};
+
+static void init_antinode_set(struct antinode_set *set, uint64_t tile_count)
+{
+	set->tile_count = tile_count;
+	set->bitmap = NULL;
+	set->keys = NULL;
+	set->key_count = 0;
+	set->key_size = 0;
+	if (tile_count <= ANTINODE_BITMAP_MAX) {
+		set->bitmap = calloc(BITMAP_WORDS(tile_count),
+			sizeof(unsigned long));
+		assert(set->bitmap != NULL);
+	}
+	return;
+}
+
+static void release_antinode_set(struct antinode_set *set)
+{
+	free(set->bitmap);
+	free(set->keys);
+	set->bitmap = NULL;
+	set->keys = NULL;
+	return;
+}
+
+/* adding a tile twice is harmless, so there's no need to look for an
+ * existing antinode first. */
+static void antinode_set_add(struct antinode_set *set, uint64_t key)
+{
+	assert(key < set->tile_count);
+	if (set->bitmap != NULL) {
+		__atomic_fetch_or(&set->bitmap[key / BITS_PER_WORD],
+			1UL << (key % BITS_PER_WORD), __ATOMIC_RELAXED);
+		return;
+	}
+
+	if (set->key_count == set->key_size) {
+		set->key_size = set->key_size ? set->key_size * 2 :
+			ANTINODE_KEYS_SIZE;
+		set->keys = realloc(set->keys, set->key_size * sizeof * set->keys);
+		assert(set->keys != NULL);
+	}
+	set->keys[set->key_count] = key;
+	set->key_count += 1;
+	return;
+}
+
+/* move the keys of a sparse set over to another sparse set */
+static void antinode_set_merge(struct antinode_set *set,
+	struct antinode_set *other)
 {
-	struct stat statbuf;
-	char *buffer;
-	size_t map_size;
 	size_t i;
-	FILE *input;
-	int ch;
+	assert(set->bitmap == NULL);
+	assert(other->bitmap == NULL);
+	for (i = 0; i < other->key_count; i++) {
+		antinode_set_add(set, other->keys[i]);
+	}
+	other->key_count = 0;
+	return;
+}
 
-	if (stat("input", &statbuf) == -1) {
-		fprintf(stderr, "cannot stat input\n");
-		exit(-1);
+static int compare_keys(const void *a, const void *b)
+{
+	uint64_t key_a = *(const uint64_t *)a;
+	uint64_t key_b = *(const uint64_t *)b;
+	return (key_a > key_b) - (key_a < key_b);
+}
+
+static size_t antinode_set_count(struct antinode_set *set)
+{
+	size_t count = 0;
+	size_t i;
+
+	if (set->bitmap != NULL) {
+		for (i = 0; i < BITMAP_WORDS(set->tile_count); i++) {
+			count += __builtin_popcountl(set->bitmap[i]);
+		}
+		return count;
 	}
-	buffer = malloc(statbuf.st_size);
-	assert(buffer != NULL);
+
+	qsort(set->keys, set->key_count, sizeof * set->keys, compare_keys);
+	for (i = 0; i < set->key_count; i++) {
+		if ((i == 0) || (set->keys[i] != set->keys[i - 1]))
+			count += 1;
+	}
+	return count;
+}
+
+static void antenna_new(struct tile_map *map, int freq, int x, int y)
+{
+	struct antenna_list *list;
+	
+	assert((freq > 0) && (freq < CHAR_MAX));
+	list = &map->antenna_lut[freq];
+	if (list->count == list->size) {
+		list->size = list->size ? list->size * 2 : ANTENNA_LIST_SIZE;
+		list->coords = realloc(list->coords,
+			list->size * sizeof * list->coords);
+		assert(list->coords != NULL);
+	}
+	list->coords[list->count].x = x;
+	list->coords[list->count].y = y;
+	list->count += 1;
+	return;
+}
+
+/* so apparently, every other character is a frequency except
+ * the dot character which denotes an empty tile. */
+static inline bool is_antenna_tile(int ch)
+{
+	return ch != '.';
+}
+
+/* stream the field through a small chunk buffer and only keep the 
+ * antennas. x is the row and y the column of a tile. */
+static void scan_antenna_field(struct tile_map *map, char *pathname)
+{
+	char chunk[4096];
+	size_t len;
+	size_t i;
+	FILE *input;
+	int x = 0;
+	int y = 0;
 
 	input = fopen(pathname, "r");
-	assert(input != NULL);
-	map_size = 0;
-	map->line_size = 0;
-	while((ch = fgetc(input)) != EOF) {
-		if (ch != '\n') {
-			*(buffer + map_size) = (char)ch;
-			map_size += 1;
-		}
+	if (input == NULL) {
+		fprintf(stderr, "cannot open %s\n", pathname);
+		exit(-1);
+	}
 
-		if (ch == '\n' && (map->line_size == 0)) {
-			map->line_size = map_size;
+	map->width = 0;
+	while ((len = fread(chunk, 1, sizeof chunk, input)) > 0) {
+		for (i = 0; i < len; i++) {
+			int ch = chunk[i] & 0xFF;
+			if (ch == '\n') {
+				if (y == 0)
+					continue;
+				if (map->width == 0)
+					map->width = y;
+				assert(map->width == y);
+				x += 1;
+				y = 0;
+				continue;
+			}
+			if (is_antenna_tile(ch)) {
+				antenna_new(map, ch, x, y);
+			}
+			y += 1;
 		}
 	}
 	fclose(input);
-	map->buffer = buffer;
-	map->size = map_size;
-	for (i = 0; i < CHAR_MAX; i++) {
-		map->antenna_lut[i] = NULL;
+
+	/* last line might not have a newline */
+	if (y != 0) {
+		if (map->width == 0)
+			map->width = y;
+		assert(map->width == y);
+		x += 1;
 	}
+	map->height = x;
 	return;
 }
 
 static struct tile_map *new_tile_map_from_input(char *pathname)
 {
 	struct tile_map *map;
+	size_t i;
 	map = malloc(sizeof * map);
-	init_tile_map(map, pathname);
 	assert(map != NULL);
+	for (i = 0; i < CHAR_MAX; i++) {
+		map->antenna_lut[i].coords = NULL;
+		map->antenna_lut[i].count = 0;
+		map->antenna_lut[i].size = 0;
+	}
+	scan_antenna_field(map, pathname);
+	init_antinode_set(&map->antinodes,
+		(uint64_t)map->width * (uint64_t)map->height);
 	return map;
 }
 
-static void new_antenna(struct antenna **ant_pp, uintptr_t location, int freq)
+static inline bool coord_in_map(struct tile_map *map, int x, int y)
 {
-	struct antenna *ant;
-	ant = malloc(sizeof * ant);
-	assert(ant != NULL);
-
-	ant->location = location;
-	ant->frequency = freq;
-	ant->next = NULL;
-	*ant_pp = ant;
-	return;
+	return (x >= 0) && (x < map->height) && (y >= 0) && (y < map->width);
 }
 
-static void antenna_new(struct tile_map *map, char *location)
+static inline uint64_t coord_key(struct tile_map *map, int x, int y)
 {
-	struct antenna **ant_pp;
-	int freq = (*location) & 0xFF;
-	
-	assert((freq > 0) && (freq < CHAR_MAX));
-	ant_pp = &(map->antenna_lut[freq]);
-	for (;;) {
-		struct antenna *ant_ptr = *ant_pp;
-		if (ant_ptr == NULL) {
-			break;
-		}
-		assert(ant_ptr->location != (uintptr_t)location);
-		assert(ant_ptr->frequency == freq);
-		ant_pp = &(ant_ptr->next);
-	}
-	new_antenna(ant_pp, (uintptr_t)location, freq);
-	return;
+	return (uint64_t)x * (uint64_t)map->width + (uint64_t)y;
 }
 
-/* so apparently, every other character is a frequency except
- * the dot character which denotes an empty tile. */
-static inline bool is_antenna_tile(char *location)
+/* an antinode sits on the far side of each antenna, as far away from it as
+ * the other antenna is. */
+static void install_antinode(struct tile_map *map,
+		struct antinode_set *antinodes, struct coord *ant1,
+		struct coord *ant2)
 {
-	return *location != '.';
+	int x = ant1->x + (ant1->x - ant2->x);
+	int y = ant1->y + (ant1->y - ant2->y);
+
+	/* check if we are stepping off the map. */
+	if (coord_in_map(map, x, y) == false)
+		return;
+
+	antinode_set_add(antinodes, coord_key(map, x, y));
+	return;
 }
 
-static void scan_antenna_field(struct tile_map *map)
+/* a slice of the pair triangle of one frequency: all pairs (i, j) with
+ * first <= i < last and i < j. frequencies with many antennas are cut into
+ * several blocks of about PAIR_BLOCK_SIZE pairs so that one crowded
+ * frequency doesn't keep a single worker busy while the others idle. */
+struct pair_block {
+#define PAIR_BLOCK_SIZE	4096
+	struct antenna_list *list;
+	size_t first;
+	size_t last;
+};
+
+static void discover_by_antenna_list(struct tile_map *map,
+		struct antinode_set *antinodes, struct pair_block *block)
 {
-	char *tile_ptr;
-	tile_ptr = map->buffer;
-	while(tile_ptr < (map->buffer + map->size)) {
-		if (is_antenna_tile(tile_ptr)) {
-			antenna_new(map, tile_ptr);
+	struct antenna_list *list = block->list;
+	size_t i;
+	size_t j;
+
+	/* each pair gets one antinode behind either antenna */
+	for (i = block->first; i < block->last; i++) {
+		for (j = i + 1; j < list->count; j++) {
+			install_antinode(map, antinodes, &list->coords[i],
+				&list->coords[j]);
+			install_antinode(map, antinodes, &list->coords[j],
+				&list->coords[i]);
 		}
-		tile_ptr += 1;
 	}
+
 	return;
 }
 
-struct coord {
-	int x;
-	int y;
+struct discovery_job {
+	struct tile_map *map;
+	struct pair_block *blocks;
+	size_t block_count;
+	size_t block_size;
+	size_t next_block; /* handed out with an atomic add */
 };
 
-static inline void get_coord(struct tile_map *map, uintptr_t loc,
-		struct coord *coord)
+struct discovery_worker {
+	pthread_t thread;
+	struct discovery_job *job;
+	struct antinode_set *antinodes; /* shared bitmap or own key list */
+	struct antinode_set sparse;
+};
+
+static void job_add_block(struct discovery_job *job,
+		struct antenna_list *list, size_t first, size_t last)
 {
-	uintptr_t offset = loc - (uintptr_t)map->buffer;
-	coord->x = offset / map->line_size;
-	coord->y = offset % map->line_size;
+	if (job->block_count == job->block_size) {
+		job->block_size = job->block_size ? job->block_size * 2 : 64;
+		job->blocks = realloc(job->blocks,
+			job->block_size * sizeof * job->blocks);
+		assert(job->blocks != NULL);
+	}
+	job->blocks[job->block_count].list = list;
+	job->blocks[job->block_count].first = first;
+	job->blocks[job->block_count].last = last;
+	job->block_count += 1;
 	return;
 }
 
-
-/* always install antinode with reference to ant1 */
-static bool install_antinode(struct tile_map *map, struct antenna *ant1, 
-		struct antenna *ant2, intptr_t distance)
+static void job_split_antenna_list(struct discovery_job *job,
+		struct antenna_list *list)
 {
-	char *new_location;
-	int delta1;
-	int delta2;
-
-	/* distance cannot be zero! */
-	assert(distance != 0);
-	new_location = (char *)((intptr_t)ant1->location + distance);
-
-	/* check if we are stepping off the starting and ending points 
-	 * of the map. */
-	if (new_location < map->buffer)
-		return false;
-	if (new_location > ((map->buffer + map->size)-1))
-		return false;
-
-	/* if we reach here, we are still within the bounds of the start/end of 
-	 * the map. but things are more nuanced than that. so we do more 
-	 * checks. */
-	struct coord an1_coord;
-	struct coord an2_coord;
-	struct coord antinode_coord;
-
-	get_coord(map, (uintptr_t)ant1->location, &an1_coord);
-	get_coord(map, (uintptr_t)ant2->location, &an2_coord);
-	get_coord(map, (uintptr_t)new_location, &antinode_coord);
-
-	delta1 = abs(an1_coord.x - an2_coord.x);
-	delta2 = abs(an1_coord.x - antinode_coord.x);
-	if (delta1 != delta2)
-		return false;
-
-	delta1 = abs(an1_coord.y - an2_coord.y);
-	delta2 = abs(an1_coord.y - antinode_coord.y);
-	if (delta1 != delta2)
-		return false;
-
-	/* install the antinode on this tile - overwriting the antenna. */
-	if (*new_location == '#')
-		return false;
-	*new_location = '#';
-
-	return true;
-}
+	size_t first = 0;
+	size_t pairs = 0;
+	size_t i;
 
-#define for_each_antenna(ant, list) \
-	for ((ant) = (list); (ant) != NULL; (ant) = (ant)->next) 
+	for (i = 0; i < list->count; i++) {
+		/* row i of the triangle pairs antenna i with all after it */
+		pairs += list->count - i - 1;
+		if (pairs >= PAIR_BLOCK_SIZE) {
+			job_add_block(job, list, first, i + 1);
+			first = i + 1;
+			pairs = 0;
+		}
+	}
+	if (pairs > 0) {
+		job_add_block(job, list, first, list->count);
+	}
+	return;
+}
 
-static int discover_by_antenna_list(struct tile_map *map,
-		struct antenna *ant_list)
+static void *discovery_worker_run(void *param)
 {
-	int antinode_count = 0;
-	struct antenna *ant1;
-	struct antenna *ant2;
-	intptr_t distance;
-
-	for_each_antenna(ant1, ant_list) {
-		for_each_antenna(ant2, ant_list) {
-			bool install_ok;
-			if (ant1 == ant2)
-				continue;
+	struct discovery_worker *worker = param;
+	struct discovery_job *job = worker->job;
 
-			/* if distance is negative: ant1 comes before ant2.
-			 * we need to install antinode _before_ ant1.
-			 *
-			 * if distance is positive: ant1 comes after ant2.
-			 * we need to install antinode _after_ ant1.
-			 */
-			distance = (intptr_t)(ant1->location) - (intptr_t)(ant2->location);
-			install_ok = install_antinode(map, ant1, ant2,
-					distance);
-			antinode_count += (install_ok == true ? 1 : 0);
-		}
+	for (;;) {
+		size_t block;
+		block = __atomic_fetch_add(&job->next_block, 1,
+			__ATOMIC_RELAXED);
+		if (block >= job->block_count)
+			break;
+		discover_by_antenna_list(job->map, worker->antinodes,
+			&job->blocks[block]);
 	}
+	return NULL;
+}
 
-	return antinode_count;
+static int worker_count(void)
+{
+	long count;
+	count = sysconf(_SC_NPROCESSORS_ONLN);
+	if (count < 1)
+		count = 1;
+	if (count > 64)
+		count = 64;
+	return (int)count;
 }
 
 static void discover_all_antinodes(struct tile_map *map)
 {
+	struct discovery_job job;
+	struct discovery_worker *workers;
+	int nr_workers;
 	size_t i;
-	int total = 0; 
+	int id;
+
+	job.map = map;
+	job.blocks = NULL;
+	job.block_count = 0;
+	job.block_size = 0;
+	job.next_block = 0;
 	for (i = 0; i < CHAR_MAX; i++) {
-		struct antenna *ant_list = map->antenna_lut[i];
-		if (ant_list == NULL) {
+		struct antenna_list *list = &map->antenna_lut[i];
+
+		/* skip single antennas */
+		if (list->count < 2) {
 			continue;
 		}
-		total += discover_by_antenna_list(map,
-				ant_list);
+
+		job_split_antenna_list(&job, list);
 	} 
-	printf("unique antinodes: %d\n", total);
-	return; 
-}
 
-void free_antenna_list(struct antenna *list)
-{
-	struct antenna *ant;
-	struct antenna *tmp;
-	for (ant = list; ant != NULL; ) {
-		tmp = ant->next;
-		free(ant);
-		ant = tmp;
+	nr_workers = worker_count();
+	workers = malloc(nr_workers * sizeof * workers);
+	assert(workers != NULL);
+	for (id = 0; id < nr_workers; id++) {
+		struct discovery_worker *worker = &workers[id];
+		worker->job = &job;
+		worker->antinodes = &map->antinodes;
+		if (map->antinodes.bitmap == NULL) {
+			init_antinode_set(&worker->sparse, map->antinodes.tile_count);
+			worker->antinodes = &worker->sparse;
+		}
+		if (pthread_create(&worker->thread, NULL,
+			discovery_worker_run, worker) != 0) {
+			fprintf(stderr, "cannot create discovery worker\n");
+			exit(-1);
+		}
 	}
+
+	for (id = 0; id < nr_workers; id++) {
+		struct discovery_worker *worker = &workers[id];
+		pthread_join(worker->thread, NULL);
+		if (worker->antinodes == &worker->sparse) {
+			antinode_set_merge(&map->antinodes, &worker->sparse);
+			release_antinode_set(&worker->sparse);
+		}
+	}
+
+	free(workers);
+	free(job.blocks);
+	printf("unique antinodes: %zu\n", antinode_set_count(&map->antinodes));
 	return;
 }
 
@@ -248,9 +428,9 @@ static void free_tile_map(struct tile_map *map)
 {
 	size_t i;
 	for (i = 0; i < CHAR_MAX; i++) {
-		free_antenna_list(map->antenna_lut[i]);
+		free(map->antenna_lut[i].coords);
 	}
-	free(map->buffer);
+	release_antinode_set(&map->antinodes);
 	free(map);
 	return;
 }
@@ -259,9 +439,7 @@ int main(void)
 {
 	struct tile_map *antenna_field;
 	antenna_field = new_tile_map_from_input("input");
-	scan_antenna_field(antenna_field);
 	discover_all_antinodes(antenna_field);
 	free_tile_map(antenna_field);
 	return 0;
 }
-
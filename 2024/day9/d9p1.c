@@ -3,71 +3,44 @@
 #include <stdbool.h>
 #include <stdlib.h>
 
+/* the disk map as given: one block count per digit, even digits being
+ * files and odd digits free spans. blocks are never expanded, compaction
+ * walks the digits with a head and a tail cursor. */
 struct disk_struct {
-#define ENLARGE_SIZE	4
-	int *blk; /* -1 file_id means blk[idx] is a free block */
-	size_t blk_count;
+#define DISK_MAP_SIZE	4096
+	unsigned char *digits;
+	size_t digit_count;
 	size_t capacity;
 };
 
+typedef unsigned __int128 checksum_t;
+
 static void disk_enlarge_disk(struct disk_struct *disk)
 {
-	size_t new_capacity = disk->capacity + ENLARGE_SIZE;
-	disk->blk = realloc(disk->blk, new_capacity * sizeof * disk->blk);
-	assert(disk->blk != NULL);
+	size_t new_capacity = disk->capacity ? disk->capacity * 2 : DISK_MAP_SIZE;
+	disk->digits = realloc(disk->digits,
+		new_capacity * sizeof * disk->digits);
+	assert(disk->digits != NULL);
 	disk->capacity = new_capacity;
 	return;
 }
 
-static bool disk_has_enough_space(struct disk_struct *disk, size_t count)
-{
-	return (disk->capacity - disk->blk_count) > count;
-}
-
-static void disk_append_blk(struct disk_struct *disk, int file_id,
-		size_t count)
-{
-	size_t i;
-	while(!disk_has_enough_space(disk, count)) {
-		disk_enlarge_disk(disk);
-	}
-	for (i = 0; i < count; i++) {
-		disk->blk[disk->blk_count + i] = file_id;
-	}
-	disk->blk_count += i;
-	return;
-}
-
-static void disk_append_file(struct disk_struct *disk, int file_id,
-		int count)
-{
-	assert(file_id >= 0);
-	disk_append_blk(disk, file_id, count);
-	return;
-}
-
-static void disk_append_free_blk(struct disk_struct *disk, int count)
-{
-	disk_append_blk(disk, -1, count);
-	return;
-}
-
 void disk_populate(struct disk_struct *disk, FILE *stream)
 {
-	int ch;
-	int file_id = 0;
-	bool append_file = true;
-	while((ch = fgetc(stream)) != EOF) {
-		if (ch == '\n')
-			continue;
-		int blk_count = ch - '0';
-		if (append_file) {
-			disk_append_file(disk, file_id, blk_count);
-			file_id += 1;
-		} else {
-			disk_append_free_blk(disk, blk_count);
+	unsigned char chunk[DISK_MAP_SIZE];
+	size_t len;
+	size_t i;
+	while ((len = fread(chunk, 1, sizeof chunk, stream)) > 0) {
+		for (i = 0; i < len; i++) {
+			if (chunk[i] == '\n')
+				continue;
+			assert(chunk[i] >= '0' && chunk[i] <= '9');
+			if (disk->digit_count == disk->capacity) {
+				disk_enlarge_disk(disk);
+			}
+			disk->digits[disk->digit_count] = chunk[i] - '0';
+			disk->digit_count += 1;
 		}
-		append_file = !append_file;
 	}
 	return;
 }
@@ -77,77 +50,84 @@ static struct disk_struct *new_empty_disk(void)
 	struct disk_struct *empty_disk;
 	empty_disk = malloc(sizeof*empty_disk);
 	assert(empty_disk != NULL);
-	empty_disk->blk = NULL;
-	empty_disk->blk_count = 0;
+	empty_disk->digits = NULL;
+	empty_disk->digit_count = 0;
 	empty_disk->capacity = 0;
 	return empty_disk;
 }
 
-static int disk_last_file_block(struct disk_struct *disk, size_t last_blk)
+/* checksum of count blocks of file_id laid down from block pos on:
+ * file_id * (pos + pos + 1 + ... + pos + count - 1) */
+static checksum_t span_checksum(size_t file_id, size_t pos, size_t count)
 {
-	int i;
-	assert(last_blk <= disk->blk_count);
-	for (i = (last_blk - 1); i >= 0; i -= 1) {
-		if (disk->blk[i] != -1) {
-			break;
-		}
-	}
-	return i;
+	checksum_t sum;
+	sum = (checksum_t)pos * count + (checksum_t)count * (count - 1) / 2;
+	return sum * file_id;
 }
 
-static int disk_next_free_block(struct disk_struct *disk, size_t blk)
+/* compact the disk and return its checksum. the head cursor walks the
+ * digits from the front; files it meets stay in place, free spans it meets
+ * are filled with blocks taken off the file under the tail cursor. */
+static checksum_t disk_compact(struct disk_struct *disk)
 {
-	size_t i;
-	for (i = blk; i < disk->blk_count; i++) {
-		if (disk->blk[i] == -1) {
-			break;
+	checksum_t checksum = 0;
+	size_t pos = 0;
+	size_t head = 0;
+	size_t tail;
+	size_t tail_left;
+
+	if (disk->digit_count == 0)
+		return 0;
+
+	/* start from the last file, ignoring a trailing free span */
+	tail = (disk->digit_count - 1) & ~(size_t)1;
+	tail_left = disk->digits[tail];
+
+	while (head < tail) {
+		size_t free_left;
+
+		if ((head & 1) == 0) {
+			checksum += span_checksum(head / 2, pos,
+				disk->digits[head]);
+			pos += disk->digits[head];
+			head += 1;
+			continue;
 		}
-	}
-	return i;
-}
-
-static void disk_move_file(struct disk_struct *disk, int file_blk,
-		int free_blk)
-{
-	assert(disk->blk[file_blk] != -1);
-	assert(disk->blk[free_blk] == -1);
-	int file_id = disk->blk[file_blk];
-	disk->blk[file_blk] = -1;
-	disk->blk[free_blk] = file_id;
-	return;
-}
-
-static void disk_compact(struct disk_struct *disk)
-{
-	int last_file_blk = disk->blk_count;
-	int next_free_blk = 0;
-	for (;;) {
-		last_file_blk = disk_last_file_block(disk, last_file_blk);
-		if (last_file_blk == -1)
-			break;
 
-		next_free_blk = disk_next_free_block(disk, next_free_blk);
-		if (next_free_blk == -1)
-			break;
-
-		if (next_free_blk > last_file_blk)
-			break;
+		free_left = disk->digits[head];
+		while ((free_left > 0) && (head < tail)) {
+			size_t count = free_left < tail_left ? free_left : tail_left;
+			checksum += span_checksum(tail / 2, pos, count);
+			pos += count;
+			free_left -= count;
+			tail_left -= count;
+			if (tail_left == 0) {
+				tail -= 2;
+				tail_left = disk->digits[tail];
+			}
+		}
+		head += 1;
+	}
 
-		disk_move_file(disk, last_file_blk, next_free_blk);
+	/* whatever is left of the tail file stays where it is */
+	if (head == tail) {
+		checksum += span_checksum(tail / 2, pos, tail_left);
 	}
-	return;
+	return checksum;
 }
 
-static unsigned long long disk_checksum(struct disk_struct *disk)
+static void print_checksum(checksum_t checksum)
 {
-	size_t i;
-	unsigned long long checksum = 0;
-	for(i = 0; i < disk->blk_count; i++) {
-		if (disk->blk[i] == -1)
-			continue;
-		checksum = checksum + (disk->blk[i] * i);
-	}
-	return checksum;
+	char digits[40];
+	int i = sizeof digits - 1;
+	digits[i] = '\0';
+	do {
+		i -= 1;
+		digits[i] = '0' + (int)(checksum % 10);
+		checksum /= 10;
+	} while (checksum != 0);
+	printf("checksum is : %s\n", &digits[i]);
+	return;
 }
 
 static struct disk_struct *new_disk_from_input(char *pathname)
@@ -164,7 +144,7 @@ static struct disk_struct *new_disk_from_input(char *pathname)
 
 static void disk_destroy(struct disk_struct *disk)
 {
-	free(disk->blk);
+	free(disk->digits);
 	free(disk);
 	return;
 }
@@ -172,12 +152,10 @@ static void disk_destroy(struct disk_struct *disk)
 int main(void)
 {
 	struct disk_struct *disk;
-	unsigned long checksum;
+	checksum_t checksum;
 	disk = new_disk_from_input("input");
-	disk_compact(disk);
-	checksum = disk_checksum(disk);
+	checksum = disk_compact(disk);
 	disk_destroy(disk);
-	printf("checksum is : %lu\n", checksum);
+	print_checksum(checksum);
 	return 0;
 }
-
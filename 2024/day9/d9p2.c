@@ -5,27 +5,141 @@
 
 struct disk_object {
 	int file_id;
-	bool cannot_move; /* only for files */
 	int size;
+	size_t pos; /* first block of the object */
 	struct disk_object *prev;
 	struct disk_object *next;
 };
 
+/* disk objects are carved out of slabs and only given back all at once
+ * when the disk is destroyed. */
+struct object_slab {
+#define OBJECT_SLAB_SIZE	1024
+	struct object_slab *next;
+	struct disk_object objects[OBJECT_SLAB_SIZE];
+};
+
+struct object_pool {
+	struct object_slab *slabs;
+	size_t used; /* objects handed out from the newest slab */
+};
+
+/* free spans of one size, as a min-heap on the span position */
+struct free_heap {
+#define FREE_HEAP_SIZE	64
+	struct disk_object **spans;
+	size_t count;
+	size_t capacity;
+};
+
 struct disk_struct {
+#define MAX_SPAN_SIZE	9
 	struct disk_object contents;
+	struct object_pool pool;
+	struct free_heap free_heaps[MAX_SPAN_SIZE + 1];
+	struct disk_object **files; /* indexed by file id */
+	size_t file_count;
+	size_t file_capacity;
+	size_t blk_count;
 };
 
-static struct disk_object *new_disk_object(int file_id, int size)
+typedef unsigned __int128 checksum_t;
+
+static struct disk_object *new_disk_object(struct object_pool *pool,
+		int file_id, int size, size_t pos)
 {
 	struct disk_object *object;
-	object = malloc(sizeof * object);
-	assert(object != NULL);
+	if ((pool->slabs == NULL) || (pool->used == OBJECT_SLAB_SIZE)) {
+		struct object_slab *slab;
+		slab = malloc(sizeof * slab);
+		assert(slab != NULL);
+		slab->next = pool->slabs;
+		pool->slabs = slab;
+		pool->used = 0;
+	}
+	object = &pool->slabs->objects[pool->used];
+	pool->used += 1;
 	object->file_id = file_id;
-	object->cannot_move = false;
 	object->size = size;
+	object->pos = pos;
 	return object;
 }
 
+static void release_object_pool(struct object_pool *pool)
+{
+	while (pool->slabs != NULL) {
+		struct object_slab *next = pool->slabs->next;
+		free(pool->slabs);
+		pool->slabs = next;
+	}
+	return;
+}
+
+static void free_heap_push(struct free_heap *heap, struct disk_object *span)
+{
+	size_t i;
+	if (heap->count == heap->capacity) {
+		heap->capacity = heap->capacity ? heap->capacity * 2 :
+			FREE_HEAP_SIZE;
+		heap->spans = realloc(heap->spans,
+			heap->capacity * sizeof * heap->spans);
+		assert(heap->spans != NULL);
+	}
+
+	/* sift up */
+	for (i = heap->count; i > 0; ) {
+		size_t parent = (i - 1) / 2;
+		if (heap->spans[parent]->pos <= span->pos)
+			break;
+		heap->spans[i] = heap->spans[parent];
+		i = parent;
+	}
+	heap->spans[i] = span;
+	heap->count += 1;
+	return;
+}
+
+static struct disk_object *free_heap_top(struct free_heap *heap)
+{
+	return heap->count == 0 ? NULL : heap->spans[0];
+}
+
+static void free_heap_pop(struct free_heap *heap)
+{
+	struct disk_object *last;
+	size_t i = 0;
+	assert(heap->count > 0);
+	heap->count -= 1;
+	last = heap->spans[heap->count];
+
+	/* sift down */
+	for (;;) {
+		size_t child = i * 2 + 1;
+		if (child >= heap->count)
+			break;
+		if ((child + 1 < heap->count) &&
+			(heap->spans[child + 1]->pos < heap->spans[child]->pos))
+			child += 1;
+		if (last->pos <= heap->spans[child]->pos)
+			break;
+		heap->spans[i] = heap->spans[child];
+		i = child;
+	}
+	heap->spans[i] = last;
+	return;
+}
+
+static void disk_add_free_span(struct disk_struct *disk,
+		struct disk_object *span)
+{
+	assert(span->file_id == -1);
+	assert(span->size <= MAX_SPAN_SIZE);
+	/* nothing fits into an empty span */
+	if (span->size > 0)
+		free_heap_push(&disk->free_heaps[span->size], span);
+	return;
+}
+
 static void insert_disk_object(struct disk_object *before,
 		struct disk_object *new_object,
 		struct disk_object *after)
@@ -44,26 +158,37 @@ static void append_disk_object(struct disk_object *before,
 	return;
 }
 
-static void disk_append_new_object(struct disk_struct *disk,
+static struct disk_object *disk_append_new_object(struct disk_struct *disk,
 		int file_id, int size)
 {
 	struct disk_object *object;
-	object = new_disk_object(file_id, size);
+	object = new_disk_object(&disk->pool, file_id, size, disk->blk_count);
 	append_disk_object(disk->contents.prev, object);
-	return;
+	disk->blk_count += size;
+	return object;
 }
 
 static void disk_append_file(struct disk_struct *disk, int file_id,
 		int size)
 {
 	assert(file_id >= 0);
-	disk_append_new_object(disk, file_id, size);
+	assert((size_t)file_id == disk->file_count);
+	if (disk->file_count == disk->file_capacity) {
+		disk->file_capacity = disk->file_capacity ?
+			disk->file_capacity * 2 : FREE_HEAP_SIZE;
+		disk->files = realloc(disk->files,
+			disk->file_capacity * sizeof * disk->files);
+		assert(disk->files != NULL);
+	}
+	disk->files[disk->file_count] = disk_append_new_object(disk, file_id,
+		size);
+	disk->file_count += 1;
 	return;
 }
 
 static void disk_append_free(struct disk_struct *disk, int size)
 {
-	disk_append_new_object(disk, -1, size);
+	disk_add_free_span(disk, disk_append_new_object(disk, -1, size));
 	return;
 }
 
@@ -76,6 +201,7 @@ void disk_populate(struct disk_struct *disk, FILE *stream)
 		if (ch == '\n')
 			continue;
 		int blk_count = ch - '0';
+		assert(blk_count >= 0 && blk_count <= MAX_SPAN_SIZE);
 		if (append_file) {
 			disk_append_file(disk, file_id, blk_count);
 			file_id += 1;
@@ -90,53 +216,41 @@ void disk_populate(struct disk_struct *disk, FILE *stream)
 static struct disk_struct *new_empty_disk(void)
 {
 	struct disk_struct *empty_disk;
-	empty_disk = malloc(sizeof*empty_disk);
+	empty_disk = calloc(1, sizeof*empty_disk);
 	assert(empty_disk != NULL);
 	empty_disk->contents.next = &empty_disk->contents;
 	empty_disk->contents.prev = &empty_disk->contents;
 	return empty_disk;
 }
 
-static struct disk_object *disk_get_last_file_object(struct disk_struct *disk)
-{
-	struct disk_object *object;
-	for (object = disk->contents.prev;
-			object != &disk->contents;
-			object = object->prev) {
-		if (object->file_id == -1) 
-			continue;
-
-		if (object->cannot_move == false) 
-			break;
-	}
-	return object == &disk->contents ? NULL : object;
-}
-
-static struct disk_object *disk_get_first_free_object(struct disk_struct *disk,
-		int size)
+/* the leftmost free span that can take size blocks, looking only at spans
+ * in front of limit. the span is taken off its heap. */
+static struct disk_object *disk_take_free_span(struct disk_struct *disk,
+		int size, size_t limit)
 {
-	struct disk_object *object;
-	for (object = disk->contents.next;
-			object != &disk->contents;
-			object = object->next) {
-		if (object->file_id != -1)
+	struct disk_object *best = NULL;
+	int best_size = 0;
+	int span_size;
+
+	for (span_size = size; span_size <= MAX_SPAN_SIZE; span_size++) {
+		struct disk_object *span;
+		span = free_heap_top(&disk->free_heaps[span_size]);
+		if (span == NULL || span->pos >= limit)
 			continue;
-
-		if (object->size >= size)
-			break;
+		if (best == NULL || span->pos < best->pos) {
+			best = span;
+			best_size = span_size;
+		}
 	}
-	return object == &disk->contents ? NULL : object;
+	if (best != NULL)
+		free_heap_pop(&disk->free_heaps[best_size]);
+	return best;
 }
 
-static void mark_file_object_non_movable(struct disk_object *object)
-{
-	assert(object->file_id != -1);
-	object->cannot_move = true;
-	return;
-}
-
-static struct disk_object *fragment_free_block(struct disk_object *object,
-		int file_size)
+/* cut a free span down to file_size blocks. the remainder becomes a new
+ * free span right after it and goes back on the heaps. */
+static struct disk_object *fragment_free_block(struct disk_struct *disk,
+		struct disk_object *object, int file_size)
 {
 	struct disk_object *object2;
 	int object2_size;
@@ -147,8 +261,10 @@ static struct disk_object *fragment_free_block(struct disk_object *object,
 	object2_size = object->size - file_size;
 
 	object->size = file_size;
-	object2 = new_disk_object(-1, object2_size);
+	object2 = new_disk_object(&disk->pool, -1, object2_size,
+		object->pos + file_size);
 	append_disk_object(object, object2);
+	disk_add_free_span(disk, object2);
 	return object;
 }
 
@@ -165,89 +281,32 @@ static void swap_disk_objects(struct disk_object *file_object,
 	return;
 }
 
-/* make sure disk_object is found in disk */
-static bool disk_object_valid(struct disk_struct *disk,
-		struct disk_object *object)
-{
-	struct disk_object *tmp;
-	for (tmp = disk->contents.next;	tmp != &disk->contents;
-		tmp = tmp->next) {
-		if (tmp == object) {
-			return true;
-		}
-	}
-	return false;
-}
-
-static bool disk_valid_move(struct disk_struct *disk,
-		struct disk_object *free_object,
-		struct disk_object *file_object)
-{
-	bool file_object_reached = false;
-	struct disk_object *tmp;
-
-	if (!disk_object_valid(disk, free_object)) {
-		return false;
-	}
-
-	if(!disk_object_valid(disk, file_object)) {
-		return false;
-	}
-
-	/* make sure we can reach free_object without first reaching 
-	 * the file_object first */
-	for (tmp = disk->contents.next; tmp != &disk->contents;
-		tmp = tmp->next) {
-		if (tmp == free_object) {
-			break;
-		}
-
-		if (tmp == file_object) {
-			file_object_reached = true;
-			break;
-		}
-	}
-	return !file_object_reached;
-}
-
+/* every file is tried once, in order of decreasing file id. the space a
+ * file leaves behind is never put back on the heaps: all files still to
+ * come sit in front of it and files only ever move left. */
 static void disk_compact(struct disk_struct *disk)
 {
-	struct disk_object *file_object;
-	struct disk_object *free_object;
-	for (;;) {
-		/* get last disk content that is a file */
-		file_object = disk_get_last_file_object(disk);
-
-		/* no more files left to move */
-		if (file_object == NULL) 
-			break;
-
-		/* get first free block that is big enough for file block */
-		free_object = disk_get_first_free_object(disk, 
-				file_object->size);
-
-		/* if we cant move this file i.e. no free blocks big 
-		 * enough for it, mark it non-moveable. */
-		if (free_object == NULL) {
-			mark_file_object_non_movable(file_object);
+	size_t file_id;
+	for (file_id = disk->file_count; file_id > 0; file_id--) {
+		struct disk_object *file_object;
+		struct disk_object *free_object;
+		file_object = disk->files[file_id - 1];
+
+		/* get first free block in front of the file that is big
+		 * enough for it, if any */
+		free_object = disk_take_free_span(disk, file_object->size,
+				file_object->pos);
+		if (free_object == NULL)
 			continue;
-		}
-
-		/* valid file moves are only possible going to the left 
-		 * direction. */
-		if (!disk_valid_move(disk, free_object, file_object)) {
-			mark_file_object_non_movable(file_object);
-			continue;
-		}
 
 		/* fragment the free block if necessary */
-		free_object = fragment_free_block(free_object,
+		free_object = fragment_free_block(disk, free_object,
 				file_object->size);
 
 		/* file block size should be equal to file block now 
 		 * so swap them */
 		swap_disk_objects(file_object, free_object);
-		mark_file_object_non_movable(free_object);
+		disk->files[file_id - 1] = free_object;
 	}
 	return;
 }
@@ -266,52 +325,62 @@ static struct disk_struct *new_disk_from_input(char *pathname)
 
 static void disk_destroy(struct disk_struct *disk)
 {
-	struct disk_object *tmp;
-	for (tmp = disk->contents.next; tmp != &disk->contents; ) {
-		struct disk_object *next = tmp->next;
-		free(tmp);
-		tmp = next;
+	int i;
+	for (i = 0; i <= MAX_SPAN_SIZE; i++) {
+		free(disk->free_heaps[i].spans);
 	}
+	release_object_pool(&disk->pool);
+	free(disk->files);
 	free(disk);
 	return;
 }
 
-static unsigned long object_checksum(struct disk_object *object,
-		int pos)
+/* checksum of count blocks of file_id laid down from block pos on:
+ * file_id * (pos + pos + 1 + ... + pos + count - 1) */
+static checksum_t span_checksum(size_t file_id, size_t pos, size_t count)
 {
-	unsigned long checksum = 0;
-	int i;
-	for (i = 0; i < object->size; i++) {
-		checksum += (object->file_id * pos);
-		pos += 1;
-	}
-	return checksum;
+	checksum_t sum;
+	sum = (checksum_t)pos * count + (checksum_t)count * (count - 1) / 2;
+	return sum * file_id;
 }
 
-static unsigned long disk_checksum(struct disk_struct *disk)
+static checksum_t disk_checksum(struct disk_struct *disk)
 {
 	struct disk_object *tmp;
-	unsigned long checksum = 0;
-	int pos = 0;
+	checksum_t checksum = 0;
+	size_t pos = 0;
 	for (tmp = disk->contents.next; tmp != &disk->contents;
 		tmp = tmp->next) {
 		if (tmp->file_id != -1) {
-			checksum = checksum + object_checksum(tmp, pos);
+			checksum += span_checksum(tmp->file_id, pos, tmp->size);
 		}
 		pos = pos + tmp->size;
 	}
 	return checksum;
 }
 
+static void print_checksum(checksum_t checksum)
+{
+	char digits[40];
+	int i = sizeof digits - 1;
+	digits[i] = '\0';
+	do {
+		i -= 1;
+		digits[i] = '0' + (int)(checksum % 10);
+		checksum /= 10;
+	} while (checksum != 0);
+	printf("checksum is : %s\n", &digits[i]);
+	return;
+}
+
 int main(void)
 {
 	struct disk_struct *disk;
-	unsigned long checksum;
+	checksum_t checksum;
 	disk = new_disk_from_input("input");
 	disk_compact(disk);
 	checksum = disk_checksum(disk);
 	disk_destroy(disk);
-	printf("checksum is : %lu\n", checksum);
+	print_checksum(checksum);
 	return 0;
 }
-